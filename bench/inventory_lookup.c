@@ -0,0 +1,90 @@
+// Inventory lookup benchmark: shows that resolving a name and calling addItem/hasEnoughItem/removeItem
+// stays flat as the number of distinct items grows.
+//
+// Build & run from the repository root:
+//   gcc -O2 bench/inventory_lookup.c -o inventory_lookup -pthread
+//   ./inventory_lookup
+
+#include "../witcher.c"
+
+#include <time.h>
+
+#define LOOKUPS 1000000
+#define MAX_ITEMS 100000
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Slice sliceOf(const char* text) {
+    return (Slice){text, (int)strlen(text)};
+}
+
+// Checks if the inventory has at least the required quantity, as the interpreter's brew check once did.
+static int hasEnoughItem(WitcherState* w, Sym name, int quantity) {
+    int index = findItem(w, name);
+    return index != -1 && *itemQuantityAt(w, index) >= quantity;
+}
+
+// The lookup every inventory function used before the index, kept here for comparison.
+static int linearFind(WitcherState* w, const char* name) {
+    for (int i = 0; i < w->itemNames.count; i++) {
+        if (strcasecmp(symName(w, *itemNameAt(w, i)), name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int main(void) {
+    static char names[MAX_ITEMS][MAX_NAME_LEN];
+    static const int sizes[] = {100, 1000, 10000, 100000};
+    volatile int sink = 0;
+    WitcherState* w = witcherCreate();
+
+    printf("%8s %14s %14s %14s %14s\n", "items", "add ns/op", "hit ns/op", "miss ns/op", "linear ns/op");
+    int previous = 0;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        // Each round grows the inventory from the previous size to n distinct items.
+        int n = sizes[s];
+        for (int i = previous; i < n; i++)
+            snprintf(names[i], MAX_NAME_LEN, "Ingredient%d", i);
+
+        double start = nowSeconds();
+        for (int i = previous; i < n; i++)
+            addItem(w, intern(w, sliceOf(names[i])), 1 + i % 7);
+        double addNs = (nowSeconds() - start) * 1e9 / (n - previous);
+        previous = n;
+
+        unsigned int seed = 12345;
+        start = nowSeconds();
+        for (int i = 0; i < LOOKUPS; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int k = (seed >> 8) % n;
+            sink += hasEnoughItem(w, findSym(w, sliceOf(names[k])), 1);
+            removeItem(w, findSym(w, sliceOf(names[k])), 1);
+            addItem(w, intern(w, sliceOf(names[k])), 1);
+        }
+        double hitNs = (nowSeconds() - start) * 1e9 / (LOOKUPS * 3.0);
+
+        static char missing[1024][MAX_NAME_LEN];
+        for (int i = 0; i < 1024; i++)
+            snprintf(missing[i], MAX_NAME_LEN, "Missing%d", i);
+        start = nowSeconds();
+        for (int i = 0; i < LOOKUPS; i++)
+            sink += hasEnoughItem(w, findSym(w, sliceOf(missing[i & 1023])), 1);
+        double missNs = (nowSeconds() - start) * 1e9 / LOOKUPS;
+
+        // The linear scan costs O(items) per lookup, so sample it with fewer lookups.
+        int linearLookups = LOOKUPS / n > 0 ? LOOKUPS / n * 10 : 10;
+        start = nowSeconds();
+        for (int i = 0; i < linearLookups; i++)
+            sink += linearFind(w, names[(i * 7919) % n]);
+        double linearNs = (nowSeconds() - start) * 1e9 / linearLookups;
+
+        printf("%8d %14.1f %14.1f %14.1f %14.1f\n", n, addNs, hitNs, missNs, linearNs);
+    }
+    witcherDestroy(w);
+    return sink == -1;
+}
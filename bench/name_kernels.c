@@ -0,0 +1,203 @@
+// Name kernel benchmark: checks that the scalar, SSE2 and AVX2 name kernels answer exactly like the C
+// library calls they replace, then times each against them.
+//
+// Build & run from the repository root:
+//   gcc -O2 bench/name_kernels.c -o name_kernels -pthread
+//   ./name_kernels
+//
+// Columns: compare of two unrelated names, compare of a name with a respelling of itself (the whole
+// name is read), equality of a name and a respelling, and the search for a keyword in a command line.
+// The libc row's search is a strncmp loop; the scalar search is the one the lexer used before.
+// Exits with status 1 if any kernel disagrees with the reference.
+
+#include "../witcher.c"
+
+#include <time.h>
+
+#define NAMES 4096
+#define CALLS 4000000
+#define LINES 1024
+
+typedef struct {
+    const char* label;
+    int (*compare)(const char*, const char*);
+    int (*equal)(const char*, const char*, int);
+    const char* (*find)(const char*, const char*, const char*);
+} Kernels;
+
+static char names[NAMES][MAX_NAME_LEN];
+static char respelled[NAMES][MAX_NAME_LEN]; // Each name with its letters' case flipped at random
+static int nameLen[NAMES];
+static char lines[LINES][MAX_INPUT_LEN];
+static int lineLen[LINES];
+static int (*sortCompare)(const char*, const char*);
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int seed = 2463534242u;
+
+static unsigned int nextRandom(void) { // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+static int strcasecmpRef(const char* a, const char* b) {
+    return strcasecmp(a, b);
+}
+
+static int strncasecmpRef(const char* a, const char* b, int len) {
+    return strncasecmp(a, b, len) == 0;
+}
+
+// Substring search the obvious way, as the reference for findText.
+static const char* naiveFind(const char* start, const char* end, const char* needle) {
+    size_t len = strlen(needle);
+    for (; end - start >= (ptrdiff_t)len; start++) {
+        if (strncmp(start, needle, len) == 0)
+            return start;
+    }
+    return NULL;
+}
+
+static int sortByName(const void* a, const void* b) {
+    return sortCompare(names[*(const int*)a], names[*(const int*)b]);
+}
+
+// Names share prefixes, mix cases and include the bytes either side of 'A'-'Z' and 'a'-'z' plus
+// bytes above 127, which folding must leave alone. The bytes after each NUL are garbage.
+static void makeNames(void) {
+    static const char alphabet[] = "AaZz@[`{ -MmQq\x80\xC1\xDA\xFA";
+    for (int i = 0; i < NAMES; i++) {
+        for (int b = 0; b < MAX_NAME_LEN; b++)
+            names[i][b] = (char)nextRandom();
+        int len = 1 + nextRandom() % (MAX_NAME_LEN - 1);
+        int shared = i > 0 && nextRandom() % 2 ? nextRandom() % (nameLen[i - 1] + 1) : 0;
+        if (shared > len)
+            shared = len;
+        memcpy(names[i], names[i - (i > 0)], shared);
+        for (int b = shared; b < len; b++)
+            names[i][b] = alphabet[nextRandom() % (sizeof(alphabet) - 1)];
+        names[i][len] = '\0';
+        nameLen[i] = len;
+        memcpy(respelled[i], names[i], MAX_NAME_LEN);
+        for (int b = 0; b < len; b++) {
+            if (isalpha((unsigned char)names[i][b]) && nextRandom() % 2)
+                respelled[i][b] ^= 'a' - 'A';
+        }
+    }
+    for (int i = 0; i < LINES; i++) {
+        int len = snprintf(lines[i], MAX_INPUT_LEN, "Geralt learns %s potion consists of 2 %s, 1 %s",
+                           names[i % NAMES] + nameLen[i % NAMES] / 2, names[(i * 7) % NAMES], names[(i * 13) % NAMES]);
+        lineLen[i] = len < MAX_INPUT_LEN ? len : MAX_INPUT_LEN - 1;
+    }
+}
+
+// Returns the number of disagreements between the kernels and the reference.
+static int verify(const Kernels* k) {
+    int errors = 0;
+    for (int i = 0; i < NAMES; i++) {
+        for (int j = 0; j < 64; j++) {
+            int other = (i + j * 97) % NAMES;
+            const char* b = j % 4 == 0 ? respelled[i] : names[other];
+            if (sign(k->compare(names[i], b)) != sign(strcasecmp(names[i], b)))
+                errors++;
+            int len = nameLen[i] < (int)strlen(b) ? nameLen[i] : (int)strlen(b);
+            if (k->equal(names[i], b, len) != (strncasecmp(names[i], b, len) == 0))
+                errors++;
+        }
+    }
+    static const char* needles[] = {"Geralt loots ", "for", "is effective against", "consists of", "potion", "x"};
+    for (int i = 0; i < LINES; i++) {
+        for (int n = 0; n < (int)(sizeof(needles) / sizeof(needles[0])); n++) {
+            for (int from = 0; from < 40 && from <= lineLen[i]; from += 13) {
+                const char* start = lines[i] + from;
+                const char* end = lines[i] + lineLen[i];
+                if (k->find(start, end, needles[n]) != naiveFind(start, end, needles[n]))
+                    errors++;
+            }
+        }
+    }
+    // The order a sort produces must be the one strcasecmp gives.
+    static int reference[NAMES], sorted[NAMES];
+    for (int i = 0; i < NAMES; i++)
+        reference[i] = sorted[i] = i;
+    sortCompare = strcasecmpRef;
+    qsort(reference, NAMES, sizeof(int), sortByName);
+    sortCompare = k->compare;
+    qsort(sorted, NAMES, sizeof(int), sortByName);
+    for (int i = 0; i < NAMES; i++) {
+        if (strcasecmp(names[reference[i]], names[sorted[i]]) != 0)
+            errors++;
+    }
+    return errors;
+}
+
+static void timeKernels(const Kernels* k) {
+    volatile uintptr_t sink = 0;
+    double start = nowSeconds();
+    for (int i = 0; i < CALLS; i++)
+        sink += k->compare(names[i % NAMES], names[(i * 31 + 1) % NAMES]);
+    double compareNs = (nowSeconds() - start) * 1e9 / CALLS;
+
+    start = nowSeconds();
+    for (int i = 0; i < CALLS; i++)
+        sink += k->compare(names[i % NAMES], respelled[i % NAMES]);
+    double sameNs = (nowSeconds() - start) * 1e9 / CALLS;
+
+    start = nowSeconds();
+    for (int i = 0; i < CALLS; i++) {
+        int n = i % NAMES;
+        sink += k->equal(names[n], respelled[n], nameLen[n]);
+    }
+    double equalNs = (nowSeconds() - start) * 1e9 / CALLS;
+
+    start = nowSeconds();
+    for (int i = 0; i < CALLS / 4; i++) {
+        int n = i % LINES;
+        sink += (uintptr_t)k->find(lines[n], lines[n] + lineLen[n], "consists of");
+    }
+    double findNs = (nowSeconds() - start) * 1e9 / (CALLS / 4);
+
+    printf("%-8s %12.1f %12.1f %12.1f %12.1f\n", k->label, compareNs, sameNs, equalNs, findNs);
+}
+
+int main(void) {
+    Kernels kernels[4] = {
+        {"libc", strcasecmpRef, strncasecmpRef, naiveFind},
+        {"scalar", foldCompareScalar, foldEqualScalar, findTextScalar},
+    };
+    int count = 2;
+#ifdef NAME_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[count++] = (Kernels){"sse2", foldCompareSse2, foldEqualSse2, findTextSse2};
+    if (__builtin_cpu_supports("avx2"))
+        kernels[count++] = (Kernels){"avx2", foldCompareAvx2, foldEqualAvx2, findTextAvx2};
+#endif
+    makeNames();
+
+    int errors = 0;
+    for (int k = 1; k < count; k++) {
+        int e = verify(&kernels[k]);
+        if (e)
+            printf("%s: %d mismatches\n", kernels[k].label, e);
+        errors += e;
+    }
+    if (!errors)
+        printf("All kernels match strcasecmp, strncasecmp and a plain substring search\n");
+
+    printf("%-8s %12s %12s %12s %12s\n", "kernel", "compare ns", "same ns", "equal ns", "find ns");
+    for (int k = 0; k < count; k++)
+        timeKernels(&kernels[k]);
+    return errors > 0;
+}
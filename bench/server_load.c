@@ -0,0 +1,193 @@
+// Server load driver: opens many sessions on a running witchertracker --serve and streams the same
+// command file through each of them at once, then reports end-to-end command throughput.
+//
+// Build & run from the repository root:
+//   gcc -O2 bench/server_load.c -o server_load -pthread
+//   ./workload --generate --commands 100000 > commands.txt
+//   ./witchertracker --serve /tmp/witcher.sock &
+//   ./server_load --socket /tmp/witcher.sock --input commands.txt [--sessions N] [--threads N]
+//
+// Every session is "Session load<pid>-<i>", so each run starts from empty campaigns. A session sends
+// the whole file followed by "Exit" as fast as the server takes it, while reading responses, and is
+// done when the server closes the connection. Throughput counts the command lines sent.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LOAD_READ_CHUNK (1 << 16)
+
+typedef struct {
+    int fd;
+    char* request; // Session line, command file and Exit
+    size_t len;
+    size_t sent;
+    long long responseLines;
+} LoadSession;
+
+typedef struct {
+    pthread_t thread;
+    LoadSession* sessions;
+    int count;
+} LoadThread;
+
+static const char* socketPath = NULL;
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* readFile(const char* path, size_t* len) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* text = malloc(size + 1);
+    if (!text || fread(text, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    *len = size;
+    return text;
+}
+
+static int connectServer(void) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", socketPath, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+// Drives the thread's sessions with poll until the server has closed all of them.
+static void* driveSessions(void* arg) {
+    LoadThread* thread = arg;
+    struct pollfd* fds = calloc(thread->count, sizeof(struct pollfd));
+    char* buffer = malloc(LOAD_READ_CHUNK);
+    int open = thread->count;
+    for (int i = 0; i < thread->count; i++)
+        thread->sessions[i].fd = connectServer();
+    while (open > 0) {
+        for (int i = 0; i < thread->count; i++) {
+            LoadSession* s = &thread->sessions[i];
+            fds[i].fd = s->fd;
+            fds[i].events = s->fd < 0 ? 0 : POLLIN | (s->sent < s->len ? POLLOUT : 0);
+        }
+        if (poll(fds, thread->count, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+        for (int i = 0; i < thread->count; i++) {
+            LoadSession* s = &thread->sessions[i];
+            if (s->fd < 0)
+                continue;
+            if (fds[i].revents & POLLOUT) {
+                ssize_t n = send(s->fd, s->request + s->sent, s->len - s->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0)
+                    s->sent += n;
+                else if (n < 0 && errno != EAGAIN)
+                    s->sent = s->len; // The server stopped reading; collect what it answered
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = recv(s->fd, buffer, LOAD_READ_CHUNK, MSG_DONTWAIT);
+                for (ssize_t b = 0; b < n; b++)
+                    s->responseLines += buffer[b] == '\n';
+                if (n == 0 || (n < 0 && errno != EAGAIN)) {
+                    close(s->fd);
+                    s->fd = -1;
+                    open--;
+                }
+            }
+        }
+    }
+    free(buffer);
+    free(fds);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    const char* inputPath = NULL;
+    int sessionCount = 64;
+    int threadCount = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            sessionCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCount = atoi(argv[++i]);
+        } else {
+            socketPath = NULL;
+            break;
+        }
+    }
+    if (!socketPath || !inputPath || sessionCount < 1 || threadCount < 1) {
+        fprintf(stderr, "Usage: %s --socket <path> --input <file> [--sessions N] [--threads N]\n", argv[0]);
+        return 2;
+    }
+    if (threadCount > sessionCount)
+        threadCount = sessionCount;
+
+    size_t bodyLen;
+    char* body = readFile(inputPath, &bodyLen);
+    if (bodyLen > 0 && body[bodyLen - 1] != '\n')
+        body[bodyLen++] = '\n';
+    long long commands = 1; // The closing Exit
+    for (size_t b = 0; b < bodyLen; b++)
+        commands += body[b] == '\n';
+
+    LoadSession* sessions = calloc(sessionCount, sizeof(LoadSession));
+    for (int i = 0; i < sessionCount; i++) {
+        char header[64];
+        int headerLen = snprintf(header, sizeof(header), "Session load%d-%d\n", (int)getpid(), i);
+        sessions[i].len = headerLen + bodyLen + strlen("Exit\n");
+        sessions[i].request = malloc(sessions[i].len);
+        memcpy(sessions[i].request, header, headerLen);
+        memcpy(sessions[i].request + headerLen, body, bodyLen);
+        memcpy(sessions[i].request + headerLen + bodyLen, "Exit\n", strlen("Exit\n"));
+    }
+
+    LoadThread* threads = calloc(threadCount, sizeof(LoadThread));
+    double start = nowSeconds();
+    for (int t = 0, first = 0; t < threadCount; t++) {
+        threads[t].count = sessionCount / threadCount + (t < sessionCount % threadCount);
+        threads[t].sessions = sessions + first;
+        first += threads[t].count;
+        pthread_create(&threads[t].thread, NULL, driveSessions, &threads[t]);
+    }
+    for (int t = 0; t < threadCount; t++)
+        pthread_join(threads[t].thread, NULL);
+    double elapsed = nowSeconds() - start;
+
+    long long responseLines = 0;
+    for (int i = 0; i < sessionCount; i++) {
+        responseLines += sessions[i].responseLines;
+        free(sessions[i].request);
+    }
+    printf("sessions %d  threads %d  commands %lld  response lines %lld\n", sessionCount, threadCount,
+           commands * sessionCount, responseLines);
+    printf("elapsed %.3f s  %.0f commands/s\n", elapsed, commands * sessionCount / elapsed);
+    free(threads);
+    free(sessions);
+    free(body);
+    return 0;
+}
@@ -0,0 +1,406 @@
+// Synthetic workload benchmark: generates a command stream in the tracker's command grammar, drives it
+// through witcherExecute and reports throughput plus p50/p99 latency per command kind.
+//
+// Build & run from the repository root:
+//   gcc -O2 bench/workload.c witcher.c -o workload -pthread
+//   ./workload [--commands N] [--catalog N] [--seed N] [--mix loot=25,trade=5,brew=20,learn=5,encounter=15,query=30]
+//   ./workload --generate [options] > commands.txt   (only write the stream, e.g. for witchertracker --batch)
+//   ./workload --input commands.txt                  (time a recorded stream instead of a generated one)
+//
+// The catalog is N ingredients (Herb<i>) plus N/4 potions (Elixir<i>) and N/4 monsters (Monster<i>).
+// A generated stream starts with a setup section that learns every formula and monster and loots some
+// of every ingredient; the driver runs it untimed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../witcher.h"
+
+#define BATCH_OUTPUT_BUFFER (1 << 20) // Same stdout buffer as witchertracker --batch
+
+enum { MIX_LOOT, MIX_TRADE, MIX_BREW, MIX_LEARN, MIX_ENCOUNTER, MIX_QUERY, MIX_COUNT };
+
+static const char* mixNames[MIX_COUNT] = {"loot", "trade", "brew", "learn", "encounter", "query"};
+
+typedef struct {
+    int commands;
+    int catalog;
+    unsigned long long seed;
+    int mix[MIX_COUNT]; // Relative weights
+} WorkloadConfig;
+
+// Lines of a command stream, NUL-terminated in one buffer.
+typedef struct {
+    char* text;
+    size_t* starts;
+    int count;
+    int setup; // Leading lines that only build state and are not timed
+} Stream;
+
+typedef struct {
+    unsigned int* ns;
+    int count;
+    int cap;
+} Samples;
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// realloc that terminates the program instead of returning NULL.
+static void* grow(void* ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static unsigned long long rngState;
+
+static unsigned int nextRandom(void) { // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (unsigned int)((rngState * 2685821657736338717ull) >> 32);
+}
+
+static int randomBelow(int n) {
+    return (int)(nextRandom() % (unsigned int)n);
+}
+
+//Generator//
+
+static int potionCount(const WorkloadConfig* config) {
+    return config->catalog / 4 > 0 ? config->catalog / 4 : 1;
+}
+
+static int monsterCount(const WorkloadConfig* config) {
+    return config->catalog / 4 > 0 ? config->catalog / 4 : 1;
+}
+
+static const char* signs[] = {"Aard", "Igni", "Yrden", "Quen", "Axii"};
+
+static void emitFormula(FILE* out, const WorkloadConfig* config, int potion) {
+    int components = 2 + potion % 3;
+    fprintf(out, "Geralt learns Elixir%d potion consists of ", potion);
+    for (int k = 0; k < components; k++) {
+        int herb = (potion * 7 + k * 13) % config->catalog;
+        fprintf(out, "%s%d Herb%d", k ? ", " : "", 1 + (potion + k) % 3, herb);
+    }
+    fputc('\n', out);
+}
+
+static void emitEffectiveness(FILE* out, const WorkloadConfig* config, int monster, int variant) {
+    if (variant % 2 == 0)
+        fprintf(out, "Geralt learns %s sign is effective against Monster%d\n", signs[variant % 5], monster);
+    else
+        fprintf(out, "Geralt learns Elixir%d potion is effective against Monster%d\n",
+                (monster + variant) % potionCount(config), monster);
+}
+
+static void emitQuery(FILE* out, const WorkloadConfig* config) {
+    int form = randomBelow(16);
+    switch (form) { // Listings are rarer than lookups of a single name
+    case 0:
+        fprintf(out, "Total ingredient?\n");
+        break;
+    case 1:
+        fprintf(out, "Total potion?\n");
+        break;
+    case 2:
+        fprintf(out, "Total trophy?\n");
+        break;
+    default:
+        switch (form % 5) {
+        case 0:
+            fprintf(out, "Total ingredient Herb%d?\n", randomBelow(config->catalog));
+            break;
+        case 1:
+            fprintf(out, "Total potion Elixir%d?\n", randomBelow(potionCount(config)));
+            break;
+        case 2:
+            fprintf(out, "Total trophy Monster%d?\n", randomBelow(monsterCount(config)));
+            break;
+        case 3:
+            fprintf(out, "What is effective against Monster%d?\n", randomBelow(monsterCount(config)));
+            break;
+        default:
+            fprintf(out, "What is in Elixir%d?\n", randomBelow(potionCount(config)));
+            break;
+        }
+    }
+}
+
+// Writes the setup section and then config->commands mixed commands; returns the setup line count.
+static int generateWorkload(FILE* out, const WorkloadConfig* config) {
+    int setup = 0;
+    rngState = config->seed * 0x9E3779B97F4A7C15ull + 1;
+    for (int p = 0; p < potionCount(config); p++, setup++)
+        emitFormula(out, config, p);
+    for (int m = 0; m < monsterCount(config); m++, setup++)
+        emitEffectiveness(out, config, m, m);
+    for (int i = 0; i < config->catalog; i += 10, setup++) {
+        fprintf(out, "Geralt loots ");
+        for (int k = i; k < i + 10 && k < config->catalog; k++)
+            fprintf(out, "%s5 Herb%d", k > i ? ", " : "", k);
+        fputc('\n', out);
+    }
+
+    int totalWeight = 0;
+    for (int t = 0; t < MIX_COUNT; t++)
+        totalWeight += config->mix[t];
+    for (int c = 0; c < config->commands; c++) {
+        int pick = randomBelow(totalWeight);
+        int type = 0;
+        while (pick >= config->mix[type])
+            pick -= config->mix[type++];
+        switch (type) {
+        case MIX_LOOT: {
+            int entries = 1 + randomBelow(4);
+            fprintf(out, "Geralt loots ");
+            for (int k = 0; k < entries; k++)
+                fprintf(out, "%s%d Herb%d", k ? ", " : "", 1 + randomBelow(5), randomBelow(config->catalog));
+            fputc('\n', out);
+            break;
+        }
+        case MIX_TRADE:
+            fprintf(out, "Geralt trades 1 Monster%d trophy for %d Herb%d\n", randomBelow(monsterCount(config)),
+                    1 + randomBelow(3), randomBelow(config->catalog));
+            break;
+        case MIX_BREW:
+            fprintf(out, "Geralt brews Elixir%d\n", randomBelow(potionCount(config)));
+            break;
+        case MIX_LEARN:
+            if (randomBelow(2))
+                emitEffectiveness(out, config, randomBelow(monsterCount(config)), randomBelow(10));
+            else
+                emitFormula(out, config, randomBelow(potionCount(config)));
+            break;
+        case MIX_ENCOUNTER:
+            fprintf(out, "Geralt encounters a Monster%d\n", randomBelow(monsterCount(config)));
+            break;
+        default:
+            emitQuery(out, config);
+            break;
+        }
+    }
+    return setup;
+}
+
+//Driver//
+
+// Splits text into lines in place.
+static void splitLines(Stream* stream, char* text, size_t len) {
+    int cap = 1024;
+    stream->text = text;
+    stream->starts = grow(NULL, cap * sizeof(size_t));
+    stream->count = 0;
+    for (size_t pos = 0; pos < len;) {
+        char* newline = memchr(text + pos, '\n', len - pos);
+        size_t end = newline ? (size_t)(newline - text) : len;
+        text[end] = '\0';
+        if (stream->count == cap) {
+            cap *= 2;
+            stream->starts = grow(stream->starts, cap * sizeof(size_t));
+        }
+        stream->starts[stream->count++] = pos;
+        pos = end + 1;
+    }
+}
+
+static int readFile(const char* path, Stream* stream) {
+    FILE* in = fopen(path, "rb");
+    if (!in)
+        return 0;
+    size_t len = 0, cap = 1 << 20;
+    char* text = grow(NULL, cap + 1);
+    size_t got;
+    while ((got = fread(text + len, 1, cap - len, in)) > 0) {
+        len += got;
+        if (len == cap) {
+            cap *= 2;
+            text = grow(text, cap + 1);
+        }
+    }
+    fclose(in);
+    text[len] = '\0';
+    splitLines(stream, text, len);
+    stream->setup = 0;
+    return 1;
+}
+
+static void addSample(Samples* samples, unsigned int ns) {
+    if (samples->count == samples->cap) {
+        samples->cap = samples->cap ? samples->cap * 2 : 1024;
+        samples->ns = grow(samples->ns, samples->cap * sizeof(unsigned int));
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+static int compareSamples(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    return x < y ? -1 : x > y;
+}
+
+static unsigned int percentile(const Samples* samples, double p) {
+    return samples->ns[(int)(p * (samples->count - 1))];
+}
+
+// Runs one line the way witchertracker does: execute it, then write the response to stdout.
+static WitcherCommandKind runLine(WitcherState* state, const char* line, WitcherOutput* response) {
+    WitcherCommandKind kind = witcherExecute(state, line, strlen(line), response);
+    fwrite(response->text, 1, response->len, stdout);
+    response->len = 0;
+    return kind;
+}
+
+static void runStream(const Stream* stream, FILE* report) {
+    static Samples samples[WITCHER_COMMAND_KINDS];
+    WitcherState* state = witcherCreate();
+    WitcherOutput response = {0};
+
+    for (int i = 0; i < stream->setup; i++)
+        runLine(state, stream->text + stream->starts[i], &response);
+
+    int timed = 0;
+    double start = nowSeconds();
+    for (int i = stream->setup; i < stream->count; i++) {
+        const char* line = stream->text + stream->starts[i];
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        WitcherCommandKind kind = runLine(state, line, &response);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        long ns = (after.tv_sec - before.tv_sec) * 1000000000L + (after.tv_nsec - before.tv_nsec);
+        addSample(&samples[kind], ns > 0 ? (unsigned int)ns : 0);
+        timed++;
+        if (kind == WITCHER_CMD_EXIT)
+            break;
+    }
+    double elapsed = nowSeconds() - start;
+    fflush(stdout);
+
+    fprintf(report, "%d commands in %.3f s: %.0f commands/s (setup: %d untimed lines)\n", timed, elapsed,
+            timed / elapsed, stream->setup);
+    fprintf(report, "%-18s %10s %10s %10s\n", "kind", "count", "p50 ns", "p99 ns");
+    for (int k = 0; k < WITCHER_COMMAND_KINDS; k++) {
+        if (samples[k].count == 0)
+            continue;
+        qsort(samples[k].ns, samples[k].count, sizeof(unsigned int), compareSamples);
+        fprintf(report, "%-18s %10d %10u %10u\n", witcherCommandName(k), samples[k].count, percentile(&samples[k], 0.50),
+                percentile(&samples[k], 0.99));
+    }
+    free(response.text);
+    witcherDestroy(state);
+}
+
+//Options//
+
+static int parseMix(const char* text, int* mix) {
+    for (int t = 0; t < MIX_COUNT; t++)
+        mix[t] = 0;
+    while (*text) {
+        int t = 0;
+        while (t < MIX_COUNT && !(strncmp(text, mixNames[t], strlen(mixNames[t])) == 0 &&
+                                  text[strlen(mixNames[t])] == '='))
+            t++;
+        if (t == MIX_COUNT)
+            return 0;
+        text += strlen(mixNames[t]) + 1;
+        char* end;
+        long weight = strtol(text, &end, 10);
+        if (end == text || weight < 0)
+            return 0;
+        mix[t] = (int)weight;
+        if (*end == ',')
+            text = end + 1;
+        else if (*end == '\0')
+            text = end;
+        else
+            return 0;
+    }
+    int total = 0;
+    for (int t = 0; t < MIX_COUNT; t++)
+        total += mix[t];
+    return total > 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [--generate] [--commands N] [--catalog N] [--seed N]\n"
+            "          [--mix loot=W,trade=W,brew=W,learn=W,encounter=W,query=W] [--input FILE]\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    WorkloadConfig config = {1000000, 1000, 1, {25, 5, 20, 5, 15, 30}};
+    int generateOnly = 0;
+    const char* inputPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--generate") == 0) {
+            generateOnly = 1;
+        } else if (strcmp(argv[i], "--commands") == 0 && value) {
+            config.commands = atoi(value);
+            i++;
+        } else if (strcmp(argv[i], "--catalog") == 0 && value && atoi(value) > 0) {
+            config.catalog = atoi(value);
+            i++;
+        } else if (strcmp(argv[i], "--seed") == 0 && value) {
+            config.seed = strtoull(value, NULL, 10);
+            i++;
+        } else if (strcmp(argv[i], "--mix") == 0 && value && parseMix(value, config.mix)) {
+            i++;
+        } else if (strcmp(argv[i], "--input") == 0 && value) {
+            inputPath = value;
+            i++;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (generateOnly) {
+        setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+        generateWorkload(stdout, &config);
+        return 0;
+    }
+
+    Stream stream;
+    if (inputPath) {
+        if (!readFile(inputPath, &stream)) {
+            fprintf(stderr, "Cannot read %s\n", inputPath);
+            return 1;
+        }
+    } else {
+        char* text;
+        size_t len;
+        FILE* out = open_memstream(&text, &len);
+        stream.setup = generateWorkload(out, &config);
+        fclose(out);
+        splitLines(&stream, text, len);
+        printf("catalog %d, seed %llu, mix", config.catalog, config.seed);
+        for (int t = 0; t < MIX_COUNT; t++)
+            printf(" %s=%d", mixNames[t], config.mix[t]);
+        printf("\n");
+    }
+    fflush(stdout);
+
+    // Responses go to /dev/null through the same large buffer as --batch; the report keeps the real stdout.
+    FILE* report = fdopen(dup(fileno(stdout)), "w");
+    if (!report || !freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "Cannot redirect stdout\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER);
+    runStream(&stream, report);
+    fclose(report);
+    return 0;
+}
@@ -0,0 +1,495 @@
+// Server mode: many independent campaigns behind one Unix domain socket.
+//
+// Clients speak the interpreter's line protocol. The first line of a connection names its session,
+// "Session <name>"; every later line is a command for that session's campaign and is answered exactly
+// as witchertracker --batch would answer it, except that "Save <file>" is INVALID: a client must not
+// write the server's files. Sessions live until the server stops, so a client can reconnect to carry
+// on with a campaign.
+//
+// Every session belongs to one shard, picked by hashing its name, and every shard is a thread pinned
+// to its own core that owns its sessions outright: only that thread reads their connections and
+// touches their states, so shards share no locks. The accepting thread deals new connections to the
+// shards in turn, and the shard that reads the session line passes the connection on to the
+// session's own shard. A session's commands therefore run one at a time, in the order they arrive.
+// Connections are passed through each shard's lock-free inbox, which never blocks the sender, so two
+// shards handing connections to each other cannot stall one another.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "witcher.h"
+#include "server.h"
+
+#define SERVER_READ_CHUNK (1 << 16)   // Bytes read from a connection per wakeup
+#define SERVER_OUTPUT_LIMIT (1 << 20) // Unsent response bytes at which a connection stops being read
+#define SERVER_EVENTS 256             // epoll events taken per wakeup
+#define SERVER_ACCEPT_BACKOFF_MS 50   // Pause before accepting again after accept failed for lack of resources
+
+//Data Structures//
+
+typedef struct Session {
+    char name[MAX_NAME_LEN];
+    unsigned int hash;
+    WitcherState* state;
+    struct Session* next; // Next session in the same bucket
+} Session;
+
+// One client connection. It belongs to exactly one shard at a time; passing it to another shard
+// hands over the whole struct, buffered input included.
+typedef struct Connection {
+    int fd;
+    Session* session;  // NULL until the session line has been read
+    char* in;          // Received bytes not yet run
+    size_t inLen;
+    size_t inCap;
+    WitcherOutput out; // Responses; bytes before sent are already written
+    size_t sent;
+    unsigned int events; // epoll events currently asked for
+    int eof;           // The client will send nothing more
+    int closing;       // Close once out is written: Exit, end of input or an error
+    struct Connection* nextHandoff; // Next connection in a shard's inbox
+} Connection;
+
+typedef struct {
+    int index;
+    pthread_t thread;
+    int cpu;        // Core the thread is pinned to, or -1
+    int epoll;
+    _Atomic(Connection*) inbox; // Connections passed to this shard, newest first
+    int wake;       // eventfd the shard watches for an inbox that was empty
+    Session** buckets;
+    int bucketCap;  // Zero or a power of two
+    int sessionCount;
+} Shard;
+
+typedef enum {
+    INPUT_WAIT,     // Needs more input
+    INPUT_BLOCKED,  // Stopped at SERVER_OUTPUT_LIMIT
+    INPUT_HANDED_OFF // The connection now belongs to another shard
+} InputStatus;
+
+//Global Variables//
+
+// Set up before the shard threads start and only read afterwards.
+static Shard* shards = NULL;
+static int shardCount = 0;
+static int sessionTiming = 0;
+
+static volatile sig_atomic_t stopServer = 0;
+
+//Utility Functions//
+
+static void* serverAlloc(size_t size) {
+    void* ptr = calloc(1, size);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void appendOutput(WitcherOutput* out, const char* text) {
+    size_t len = strlen(text);
+    if (out->len + len > out->cap) {
+        out->cap = out->len + len > 2 * out->cap ? out->len + len : 2 * out->cap;
+        out->text = realloc(out->text, out->cap);
+        if (!out->text) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(out->text + out->len, text, len);
+    out->len += len;
+}
+
+// FNV-1a of a session name; picks both the shard and the bucket.
+static unsigned int hashSession(const char* name, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//Sessions//
+
+// Returns the shard's session of that name, creating its campaign on first use.
+static Session* findOrCreateSession(Shard* shard, const char* name, int len, unsigned int hash) {
+    int mask = shard->bucketCap - 1;
+    if (shard->bucketCap > 0) {
+        for (Session* s = shard->buckets[hash & mask]; s; s = s->next) {
+            if (s->hash == hash && (int)strlen(s->name) == len && memcmp(s->name, name, len) == 0)
+                return s;
+        }
+    }
+    if (shard->sessionCount >= shard->bucketCap) { // Keep at most one session per bucket on average
+        int cap = shard->bucketCap ? shard->bucketCap * 2 : 64;
+        Session** buckets = serverAlloc(cap * sizeof(Session*));
+        for (int b = 0; b < shard->bucketCap; b++) {
+            for (Session* s = shard->buckets[b]; s;) {
+                Session* next = s->next;
+                s->next = buckets[s->hash & (cap - 1)];
+                buckets[s->hash & (cap - 1)] = s;
+                s = next;
+            }
+        }
+        free(shard->buckets);
+        shard->buckets = buckets;
+        shard->bucketCap = cap;
+        mask = cap - 1;
+    }
+    Session* s = serverAlloc(sizeof(Session));
+    memcpy(s->name, name, len);
+    s->hash = hash;
+    s->state = witcherCreate();
+    witcherSetTiming(s->state, sessionTiming);
+    witcherSetFileCommands(s->state, 0); // A client must not write the server's files
+    s->next = shard->buckets[hash & mask];
+    shard->buckets[hash & mask] = s;
+    shard->sessionCount++;
+    return s;
+}
+
+//Connections//
+
+// Pushes the connection onto the shard's inbox. Only the push that finds the inbox empty wakes the
+// shard; later ones are taken along with it.
+static void handOff(Shard* shard, Connection* conn) {
+    Connection* head = atomic_load(&shard->inbox);
+    do
+        conn->nextHandoff = head;
+    while (!atomic_compare_exchange_weak(&shard->inbox, &head, conn));
+    uint64_t one = 1;
+    if (!head && write(shard->wake, &one, sizeof(one)) != sizeof(one)) {
+        perror("Shard handoff");
+        exit(1);
+    }
+}
+
+// Also fine for a connection the shard has not started watching; the EPOLL_CTL_DEL just fails.
+static void closeConnection(Shard* shard, Connection* conn) {
+    epoll_ctl(shard->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out.text);
+    free(conn);
+}
+
+// Asks epoll for input while the client may still send and its responses are not piling up, and
+// for writability while responses wait.
+static void watchConnection(Shard* shard, Connection* conn, int watched) {
+    unsigned int events = 0;
+    if (!conn->eof && !conn->closing && conn->out.len - conn->sent < SERVER_OUTPUT_LIMIT)
+        events |= EPOLLIN;
+    if (conn->sent < conn->out.len)
+        events |= EPOLLOUT;
+    if (watched && events == conn->events)
+        return;
+    struct epoll_event ev = {events, {.ptr = conn}};
+    if (epoll_ctl(shard->epoll, watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &ev) != 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+    conn->events = events;
+}
+
+// Reads what the client has sent, one chunk per wakeup so busy connections take turns.
+static void readInput(Connection* conn) {
+    if (conn->eof)
+        return;
+    if (conn->inLen + SERVER_READ_CHUNK > conn->inCap) {
+        conn->inCap = conn->inLen + SERVER_READ_CHUNK;
+        conn->in = realloc(conn->in, conn->inCap);
+        if (!conn->in) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    ssize_t n = read(conn->fd, conn->in + conn->inLen, conn->inCap - conn->inLen);
+    if (n > 0)
+        conn->inLen += n;
+    else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        conn->eof = 1;
+}
+
+// Writes waiting responses; returns 0 while the socket cannot take them all.
+static int flushOutput(Connection* conn) {
+    while (conn->sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.text + conn->sent, conn->out.len - conn->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return 0;
+        } else { // The client is gone; drop what it will never read
+            conn->sent = conn->out.len;
+            conn->eof = 1;
+            conn->closing = 1;
+        }
+    }
+    conn->out.len = conn->sent = 0;
+    return 1;
+}
+
+// Binds the connection to the session named by its first line. Returns the session's shard, which
+// the connection must be handed to with the line still unread when it is not this one.
+static Shard* bindSession(Shard* shard, Connection* conn, const char* line, int len) {
+    const char* end = line + len;
+    while (end > line && isspace((unsigned char)end[-1]))
+        end--;
+    const char* name = line + strlen("Session ");
+    while (name < end && isspace((unsigned char)*name))
+        name++;
+    if (strncmp(line, "Session ", strlen("Session ")) != 0 || name >= end) {
+        appendOutput(&conn->out, "Expected: Session <name>\n");
+        conn->closing = 1;
+        return shard;
+    }
+    int nameLen = (int)(end - name);
+    if (nameLen >= MAX_NAME_LEN) {
+        appendOutput(&conn->out, "Session name too long\n");
+        conn->closing = 1;
+        return shard;
+    }
+    unsigned int hash = hashSession(name, nameLen);
+    Shard* home = &shards[hash % shardCount];
+    if (home == shard)
+        conn->session = findOrCreateSession(shard, name, nameLen, hash);
+    return home;
+}
+
+// Runs the complete lines received so far, cut the way the interpreter's fgets cuts them: at a
+// newline or after MAX_INPUT_LEN - 1 bytes, and at the first NUL. A last line without a newline runs
+// once the client has finished sending.
+static InputStatus runInput(Shard* shard, Connection* conn) {
+    size_t pos = 0;
+    InputStatus status = INPUT_WAIT;
+    Shard* home = shard;
+    while (!conn->closing) {
+        if (conn->out.len - conn->sent >= SERVER_OUTPUT_LIMIT) {
+            status = INPUT_BLOCKED;
+            break;
+        }
+        char* line = conn->in + pos;
+        size_t avail = conn->inLen - pos;
+        if (avail == 0)
+            break;
+        size_t limit = avail < MAX_INPUT_LEN - 1 ? avail : MAX_INPUT_LEN - 1;
+        char* newline = memchr(line, '\n', limit);
+        size_t len, take;
+        if (newline)
+            take = (len = newline - line) + 1;
+        else if (limit == MAX_INPUT_LEN - 1 || conn->eof)
+            take = len = limit;
+        else
+            break;
+        char* nul = memchr(line, '\0', len);
+        if (nul)
+            len = nul - line;
+        if (!conn->session) {
+            if ((home = bindSession(shard, conn, line, (int)len)) != shard) {
+                status = INPUT_HANDED_OFF;
+                break;
+            }
+            pos += take;
+            continue;
+        }
+        pos += take;
+        if (witcherExecute(conn->session->state, line, (int)len, &conn->out) == WITCHER_CMD_EXIT)
+            conn->closing = 1;
+    }
+    if (pos > 0) {
+        memmove(conn->in, conn->in + pos, conn->inLen - pos);
+        conn->inLen -= pos;
+    }
+    if (status == INPUT_HANDED_OFF) {
+        epoll_ctl(shard->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->events = 0;
+        handOff(home, conn);
+    } else if (conn->eof && conn->inLen == 0) {
+        conn->closing = 1;
+    }
+    return status;
+}
+
+// Runs input and writes responses until the connection has to wait for the client or the socket.
+// watched says whether the connection is already in the shard's epoll set.
+static void serviceConnection(Shard* shard, Connection* conn, int watched) {
+    for (;;) {
+        InputStatus status = runInput(shard, conn);
+        if (status == INPUT_HANDED_OFF)
+            return;
+        if (!flushOutput(conn) || status == INPUT_WAIT || conn->closing)
+            break;
+    }
+    if (conn->closing && conn->sent == conn->out.len)
+        closeConnection(shard, conn);
+    else
+        watchConnection(shard, conn, watched);
+}
+
+// Takes the whole inbox at once, after clearing the wake-up so that a push finding the inbox empty
+// again wakes the shard anew, and services the connections in the order they were passed.
+static void takeHandoffs(Shard* shard) {
+    uint64_t count;
+    if (read(shard->wake, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Shard handoff");
+        exit(1);
+    }
+    Connection* newest = atomic_exchange(&shard->inbox, NULL);
+    Connection* oldest = NULL;
+    while (newest) {
+        Connection* next = newest->nextHandoff;
+        newest->nextHandoff = oldest;
+        oldest = newest;
+        newest = next;
+    }
+    while (oldest) {
+        Connection* next = oldest->nextHandoff;
+        serviceConnection(shard, oldest, 0);
+        oldest = next;
+    }
+}
+
+//Shards//
+
+static void* shardMain(void* arg) {
+    Shard* shard = arg;
+    if (shard->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    struct epoll_event events[SERVER_EVENTS];
+    for (;;) {
+        int n = epoll_wait(shard->epoll, events, SERVER_EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            perror("epoll_wait");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            Connection* conn = events[i].data.ptr;
+            if (!conn) {
+                takeHandoffs(shard);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                readInput(conn);
+            serviceConnection(shard, conn, 1);
+        }
+    }
+    return NULL;
+}
+
+static void startShard(Shard* shard, int index, int cpu) {
+    shard->index = index;
+    shard->cpu = cpu;
+    shard->epoll = epoll_create1(EPOLL_CLOEXEC);
+    shard->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->epoll < 0 || shard->wake < 0) {
+        perror("Shard setup");
+        exit(1);
+    }
+    struct epoll_event ev = {EPOLLIN, {.ptr = NULL}};
+    epoll_ctl(shard->epoll, EPOLL_CTL_ADD, shard->wake, &ev);
+    if (pthread_create(&shard->thread, NULL, shardMain, shard) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+}
+
+static void onStopSignal(int sig) {
+    (void)sig;
+    stopServer = 1;
+}
+
+int runServer(const char* path, int shardsWanted, int timing) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path); // Left behind by a server that did not stop cleanly
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // One shard per core the process may run on, each pinned to its own.
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int cpuCount = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed))
+                cpus[cpuCount++] = c;
+        }
+    }
+    shardCount = shardsWanted > 0 ? shardsWanted : cpuCount > 0 ? cpuCount : 1;
+    sessionTiming = timing;
+    shards = serverAlloc(shardCount * sizeof(Shard));
+
+    // Shards leave the stop signals to the accepting thread.
+    sigset_t stopSignals, previous;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
+    for (int i = 0; i < shardCount; i++)
+        startShard(&shards[i], i, cpuCount > 0 ? cpus[i % cpuCount] : -1);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    struct sigaction stop = {0};
+    stop.sa_handler = onStopSignal; // No SA_RESTART, so accept returns when a stop signal arrives
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Serving %s with %d shards\n", path, shardCount);
+    for (unsigned int next = 0, failing = 0; !stopServer;) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Out of descriptors or memory, the pending connection stays queued and accept would fail
+            // again at once: report it once and give the shards time to close connections.
+            if (!failing)
+                perror("accept");
+            failing = 1;
+            nanosleep(&(struct timespec){0, SERVER_ACCEPT_BACKOFF_MS * 1000000L}, NULL);
+            continue;
+        }
+        failing = 0;
+        Connection* conn = serverAlloc(sizeof(Connection));
+        conn->fd = fd;
+        handOff(&shards[next++ % shardCount], conn);
+    }
+    close(listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef WITCHER_SERVER_H
+#define WITCHER_SERVER_H
+
+// Serves campaigns on a Unix domain socket at path until SIGINT or SIGTERM, with one shard thread
+// per core (shards <= 0) or the given number. timing turns on latency statistics for every session.
+// Returns the process exit status.
+int runServer(const char* path, int shards, int timing);
+
+#endif
@@ -0,0 +1,3715 @@
+#include "witcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAME_KERNELS_X86 1 // SSE2 and AVX2 name kernels, picked at run time
+#endif
+
+#define ARENA_BLOCK_SIZE (1 << 16) // Default size of one arena block
+#define TABLE_CHUNK 256     // Records per table chunk
+#define VIEW_MAX_LEVEL 16   // Skip list levels in a sorted view
+#define SNAPSHOT_VERSION 7  // Bump whenever a saved record layout changes
+#define QUERY_CACHE_SLOTS 64 // Cached query answers per state, direct-mapped by query hash
+#define JOURNAL_GROUP_BYTES (1 << 16) // Journal records buffered before a group commit
+#define JOURNAL_GROUP_MS 10 // Longest a journal record waits for its group commit
+#define JOURNAL_MAGIC 0x4C4E524Au // "JRNL"
+#define REPLAY_CHUNK (1 << 20)  // Bytes of a replayed log lexed as one batch, rounded up to a whole line
+#define REPLAY_AHEAD 4          // Batches per worker that may be lexed ahead of the executor
+#define REPLAY_OUTPUT_FLUSH (1 << 20) // Response bytes collected before a replay writes them out
+#define PIPELINE_LINES 256      // Lexed lines the reader may run ahead of the executor; a power of two
+#define PIPELINE_BLOCKS 8       // Response blocks the executor may run ahead of the writer; a power of two
+#define PIPELINE_BLOCK_FLUSH (1 << 16) // Response bytes after which a block goes to the writer
+#define RING_SPINS 200          // Polls of a ring before a stage sleeps on it
+#define RING_YIELDS 8           // Of those, the last ones that yield the CPU to the other stages
+
+//Data Structures//
+
+typedef uint32_t Sym; // Interned name id; 0 means "no name"
+
+typedef WitcherSlice Slice;     // A run of characters inside an input line; not NUL-terminated
+typedef WitcherEntry ListEntry; // One "<quantity> <name>" entry of a loot, trade or formula list
+typedef WitcherCommandKind CommandKind;
+typedef WitcherStats Stats;
+
+typedef enum {
+    ITEM_INGREDIENT,
+    ITEM_POTION
+} ItemCategory;
+
+// What a query's answer can depend on. Each set has a version in the state that every change to it
+// bumps, so a cached answer is current while the versions it was formatted under are.
+typedef enum {
+    DATA_INVENTORY,
+    DATA_TROPHIES,
+    DATA_FORMULAS,
+    DATA_BESTIARY,
+    DATA_SET_COUNT
+} DataSet;
+
+// Listing order of a name folded into an integer: its first eight case-folded bytes, big-endian and
+// NUL-padded, so comparing keys orders names like strcasecmp as far as those bytes go. Only names
+// whose keys tie in all eight bytes need their text compared.
+typedef uint64_t SortKey;
+
+typedef struct {
+    Sym name;
+    int quantity;
+} Component;
+
+// Use link of component i of formula f: f * MAX_COMPONENTS + i. An ingredient's key symbol heads the
+// list of links of every component naming it, chained through Formula.nextUse.
+typedef int UseLink;
+
+// A formula is compiled when learned: each component is bound to its key symbol, whose item field is
+// the component's inventory slot, and the "What is in" order is worked out once.
+typedef struct {
+    Sym potionName;
+    Component components[MAX_COMPONENTS]; // In the order learned, which is the order brewing uses them
+    Sym keys[MAX_COMPONENTS]; // symKey() of each component's name
+    unsigned char listOrder[MAX_COMPONENTS]; // Component indices in "What is in" order
+    int componentCount;
+    UseLink nextUse[MAX_COMPONENTS]; // Next link in the list of components[i]'s ingredient, or -1
+    int brewable; // How many times the inventory could supply every component, kept by refreshBrewable
+} Formula;
+
+// Counter link of bestiary entry e: e * 2 for its effective potion, e * 2 + 1 for its sign. A potion or
+// sign's key symbol heads the list of links naming it, in monster name order.
+typedef int CounterLink;
+
+typedef struct {
+    Sym monsterName;
+    Sym effectivePotion; // Effective potion, 0 if unknown
+    Sym effectiveSign;   // Effective sign, 0 if unknown
+    CounterLink nextCounter[2]; // Neighbours of the potion's [0] and sign's [1] links in their lists, or -1
+    CounterLink prevCounter[2];
+} BestiaryEntry;
+
+// One interned spelling of a name. Every spelling of the same case-folded name points at a shared
+// key symbol, so name equality is a compare of keys; the key also carries the name's inventory slot,
+// trophy slot and formula. The text is stored inline so symbols hold no pointers and can be mapped
+// straight from a snapshot.
+typedef struct {
+    char text[MAX_NAME_LEN]; // This spelling, NUL-terminated
+    SortKey sortKey;   // sortKeyOf(text)
+    int length;        // strlen(text)
+    unsigned int hash; // hashName() of the text
+    Sym key;           // First spelling interned for this case-folded name
+    Sym nextSpelling;  // Next spelling sharing the key, 0 if none
+    int item;          // Inventory slot holding this name, or -1 (key symbols only)
+    int trophy;        // Trophy slot for this monster name, or -1 (key symbols only)
+    int formula;       // Formula book index for this potion name, or -1 (key symbols only)
+    int monster;       // Bestiary index for this monster name, or -1 (key symbols only)
+    UseLink firstUse;  // First formula component naming this ingredient, or -1 (key symbols only)
+    CounterLink firstCounter; // First bestiary entry this potion or sign counters, or -1 (key symbols only)
+} Symbol;
+
+// Bump allocator block; blocks are chained and only released with their arena.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks; // Newest first
+} Arena;
+
+// Growable table of fixed-size records. Records live in TABLE_CHUNK-sized chunks carved from the
+// arena, so growing never copies or moves existing records.
+typedef struct {
+    Arena* arena;
+    size_t recordSize;
+    char** chunks;
+    int chunkCount;
+    int chunkCap;
+    int count; // Records handed out so far
+} Table;
+
+// Skip list node of a sorted view; next[] has one entry per level of the node.
+typedef struct ViewNode {
+    int item; // Slot in the view's columns
+    int level;
+    struct ViewNode* next[];
+} ViewNode;
+
+// Slots of the inventory or trophy columns kept in listing order, so listing is a walk of level 0.
+typedef struct {
+    WitcherState* owner; // Supplies nodes and the columns compare reads
+    int (*compare)(WitcherState*, int, int); // Orders two slots
+    ViewNode* head; // Sentinel with VIEW_MAX_LEVEL levels, allocated on first insert
+    int level;      // Levels currently in use
+    int count;
+    const int* pending; // Slot order loaded from a snapshot, linked into the list on first use
+} SortedView;
+
+// Open-addressing index over key symbols, keyed on the case-folded name.
+typedef struct {
+    unsigned int hash;
+    Sym sym; // 0 for an empty slot
+} IndexSlot;
+
+// Entries lexed from the current line; the storage is reused from line to line.
+typedef struct {
+    ListEntry* entries;
+    int count;
+    int cap;
+} EntryBuffer;
+
+// One lexed input line. Slices point into the line and list entries into the entry buffer, so both
+// stay valid until the next line is read.
+typedef struct {
+    CommandKind kind;
+    const struct CommandSpec* spec; // Registered command whose keyword matched, NULL if none
+    Slice name;        // Potion, monster or queried name; empty for the listing queries
+    Slice counter;     // WITCHER_CMD_LEARN_EFFECTIVE: the effective potion or sign
+    int counterIsSign;
+    const EntryBuffer* list;
+    int firstItem;     // Ingredients (loot, trade) or components (formula) in list
+    int itemCount;
+    int firstTrophy;   // Trophies given away (trade)
+    int trophyCount;
+    int listError;     // Loot, trade: the entry after the lexed ones is malformed
+    int quantity;      // WITCHER_CMD_BULK_BREW: how many potions
+} Command;
+
+// A registered command: the keyword that selects it, the lexer for the rest of the line and the
+// handler that runs it. Handlers append their response and return 0 to have the command answered
+// with INVALID.
+typedef struct CommandSpec {
+    const char* keyword;
+    int isQuery; // Queries match case-insensitively against lines ending with '?'
+    unsigned int reads; // Queries: bits (1 << DataSet) of all the answer depends on; 0 is never cached
+    void (*lex)(Slice line, EntryBuffer* buffer, Command* cmd);
+    int (*handle)(WitcherState* w, const Command* cmd, WitcherOutput* out);
+} CommandSpec;
+
+// Byte trie over registered keywords; node 0 is the root.
+typedef struct {
+    unsigned char byte;
+    int child;   // First child, or -1
+    int sibling; // Next child of the same parent, or -1
+    int spec;    // commandSpecs index of the keyword ending here, or -1
+} TrieNode;
+
+typedef struct {
+    int foldCase; // Bytes are lowercased on insert and lookup
+    TrieNode* nodes;
+    int count;
+    int cap;
+} KeywordTrie;
+
+// An item a brew plan touches. Components of a formula are resolved to plan nodes the first time the
+// plan brews it and reused from then on.
+typedef struct {
+    Sym name;      // Spelling the item is added under if the plan leaves more than Geralt holds
+    Sym key;
+    int formula;   // Formula book index, or -1 for an ingredient Geralt cannot brew
+    int stock;     // Quantity in the inventory
+    int available; // Stock less what the plan has used so far, plus what it has brewed
+    int resolved;  // components[] is filled in
+    int brewing;   // On the current chain of sub-brews; meeting it again is a cycle
+    int components[MAX_COMPONENTS];
+} PlanNode;
+
+// Scratch of the brew planner, reused from plan to plan.
+typedef struct {
+    PlanNode* nodes;
+    int count;
+    int cap;
+    int cycle; // Node met again on its own chain of sub-brews, or -1
+} BrewPlan;
+
+// One remembered query answer: the query's command and name, and the response it produced.
+typedef struct {
+    const CommandSpec* spec; // NULL while the entry is empty
+    unsigned int hash;       // queryHash() of the command and name
+    unsigned long long stamp; // dataStamp() of the sets the answer was formatted from
+    int keyLen;  // The name is the first keyLen bytes of text, the response follows
+    char* text;
+    size_t len;
+    size_t cap;
+} QueryCacheEntry;
+
+// Snapshot file header. Files are native-endian and only read back by a build with the same record
+// layouts, which the version, byte order mark and per-section record sizes check.
+typedef struct {
+    char magic[8];      // "WITCHSNP"
+    uint32_t version;   // SNAPSHOT_VERSION
+    uint32_t byteOrder; // 0x01020304 as written
+    uint64_t size;      // Whole file, a multiple of 64
+    uint64_t campaign;  // Journal.campaign of the saved state
+    uint64_t journalSeq; // Journal records already applied to this state
+    uint64_t checksum;  // blockChecksum() of everything after the header
+} SnapshotHeader;
+
+// Where one table, index or view order lives in a snapshot; the header is followed by one of these
+// per SnapshotSectionId.
+typedef struct {
+    uint64_t offset;     // From the start of the file, 64-byte aligned
+    uint64_t count;      // Records
+    uint32_t recordSize;
+    uint32_t extra;      // Symbol index: key symbols in use
+} SnapshotSection;
+
+typedef enum {
+    SNAP_SYMBOLS,
+    SNAP_ITEM_NAMES,
+    SNAP_ITEM_QUANTITIES,
+    SNAP_ITEM_CATEGORIES,
+    SNAP_ITEM_SORT_KEYS,
+    SNAP_FREE_ITEMS,
+    SNAP_TROPHY_MONSTERS,
+    SNAP_TROPHY_QUANTITIES,
+    SNAP_TROPHY_SORT_KEYS,
+    SNAP_FREE_TROPHIES,
+    SNAP_FORMULAS,
+    SNAP_BESTIARY,
+    SNAP_READY_WORDS,
+    SNAP_SYMBOL_INDEX,
+    SNAP_INGREDIENT_ORDER,
+    SNAP_POTION_ORDER,
+    SNAP_TROPHY_ORDER,
+    SNAP_BREWABLE_ORDER,
+    SNAP_SECTION_COUNT
+} SnapshotSectionId;
+
+// Effects recorded in the journal. Each record is the op byte followed by its fields; names are a
+// length byte and the spelling, quantities are native 32-bit ints.
+typedef enum {
+    JOURNAL_ADD_ITEM = 1,    // name, quantity
+    JOURNAL_REMOVE_ITEM,     // name, quantity
+    JOURNAL_ADD_TROPHY,      // monster, quantity
+    JOURNAL_REMOVE_TROPHY,   // monster, quantity
+    JOURNAL_LEARN_EFFECTIVE, // monster, counter, isSign byte
+    JOURNAL_LEARN_FORMULA    // potion, component count byte, then name and quantity per component
+} JournalOp;
+
+// One group commit: this header, then its records padded to a multiple of 8 bytes.
+typedef struct {
+    uint64_t checksum; // blockChecksum() of the rest of the frame
+    uint32_t magic;    // JOURNAL_MAGIC
+    uint32_t bytes;    // Record bytes after the header, padding included
+    uint64_t campaign; // Journal.campaign of the state the records were applied to
+    uint64_t firstSeq; // Sequence number of the first record
+    uint32_t records;
+    uint32_t reserved;
+} JournalFrame;
+
+// Journal writer. Every applied mutation takes the next sequence number, journaled or not, so a
+// snapshot can say which journal records it already contains.
+typedef struct {
+    int fd;           // -1 when journaling is off
+    int replaying;    // Set while recovery re-applies records, which must not be journaled again
+    uint64_t campaign; // Random id of this history of mutations, shared by its snapshots and journal
+    uint64_t seq;     // Mutations applied so far
+    char* frame;      // Frame being filled: header space, then records
+    size_t used;
+    size_t cap;
+    uint32_t records; // Records in frame; 0 means nothing waits for a commit
+    uint64_t firstSeq;
+    long long firstNs; // When the oldest waiting record was added
+} Journal;
+
+// Commands lexed from one line-aligned chunk of a replayed log. Slices point into the mapped file and
+// list entries into the batch's own entry buffer; both are reused once the executor is done with it.
+typedef struct {
+    Command* commands;
+    int count;
+    int cap;
+    EntryBuffer entries;
+    int ready; // Lexed and waiting for the executor
+} ReplayBatch;
+
+// A replay in progress. Workers claim chunks in file order and lex each into batch seq % batchCount;
+// the executor takes the batches in the same order.
+typedef struct {
+    const char* text; // The mapped log
+    size_t len;
+    size_t next;      // Start of the first unclaimed chunk
+    long long claimed; // Chunks claimed by workers
+    long long done;   // Chunks the executor has finished with
+    int stop;         // Exit was run; workers stop claiming
+    ReplayBatch* batches;
+    int batchCount;
+    pthread_mutex_t lock;
+    pthread_cond_t lexed; // A batch became ready
+    pthread_cond_t freed; // The executor released a batch
+} Replay;
+
+// Bounded single-producer single-consumer ring of slot indices. The slots themselves live with the
+// pipeline; the producer fills slot head % size and publishes it by advancing head, the consumer
+// hands it back by advancing tail. A side that finds nothing to do spins briefly, then sleeps on the
+// other side's counter with a futex; the sleeping flags let the other side skip the wake-up call
+// while nobody sleeps.
+typedef struct {
+    _Atomic uint32_t head; // Slots published
+    _Atomic uint32_t consumerSleeping;
+    char headLine[56];     // Keeps the two counters on separate cache lines
+    _Atomic uint32_t tail; // Slots released
+    _Atomic uint32_t producerSleeping;
+    uint32_t size;
+} SpscRing;
+
+// One input line, lexed by the reader stage. The command's slices point into line.
+typedef struct {
+    char line[MAX_INPUT_LEN];
+    Command cmd;
+    EntryBuffer entries;
+    int end; // No more input
+} PipelineLine;
+
+// Responses of a run of commands, written out by the writer stage.
+typedef struct {
+    WitcherOutput out;
+    int end; // The last block
+} PipelineBlock;
+
+// A pipelined stream: the reader lexes lines into the line ring, the executor runs them and appends
+// the responses to blocks in the block ring, the writer writes the blocks out.
+typedef struct {
+    FILE* in;
+    FILE* out;
+    SpscRing lineRing;
+    SpscRing blockRing;
+    PipelineLine* lines;
+    PipelineBlock blocks[PIPELINE_BLOCKS];
+} Pipeline;
+
+// Everything one campaign owns. Tables, views and symbols are carved from the state's arena.
+struct WitcherState {
+    Arena arena;
+    Table symbols;      // Symbol 0 is reserved for "no name"
+    // Inventory and trophies are parallel columns indexed by slot, so a scan of quantities or a sorted
+    // view's comparisons touch only the column they need; names stay in the symbol pool.
+    Table itemNames;      // Sym of each inventory slot, 0 while the slot is free
+    Table itemQuantities; // int
+    Table itemCategories; // unsigned char ItemCategory, kept current by addItem and learnFormula
+    Table itemSortKeys;   // SortKey of the name
+    Table freeItems;      // Inventory slots emptied by removeItem, reused by addItem
+    Table trophyMonsters; // Sym of each trophy slot: the spelling that first earned it, 0 while free
+    Table trophyQuantities; // int
+    Table trophySortKeys; // SortKey of the monster name
+    Table freeTrophies;   // Trophy slots emptied by removeTrophy, reused by addTrophy
+    Table formulaBook;
+    Table bestiary;
+    Table readyWords; // uint64_t bitmap over the bestiary: bit e is set while Geralt could defeat entry e
+    SortedView itemViews[2]; // Indexed by ItemCategory
+    SortedView trophyView;
+    SortedView brewableView; // Formulas with brewable > 0, by potion name
+    ViewNode* freeViewNodes[VIEW_MAX_LEVEL + 1]; // Released nodes, by level
+    unsigned int viewLevelState; // xorshift32 state of randomViewLevel
+    IndexSlot* symbolIndex;
+    int symbolIndexCap;   // Always zero or a power of two
+    int symbolIndexCount; // Key symbols in the index
+    unsigned long long versions[DATA_SET_COUNT]; // Indexed by DataSet
+    QueryCacheEntry* queryCache; // QUERY_CACHE_SLOTS entries, allocated by the first cached query
+    Stats stats;
+    Journal journal;
+    EntryBuffer entries; // List entries of the line being run
+    BrewPlan plan;
+    char* snapshot;      // Mapping the state was loaded from, or NULL
+    size_t snapshotSize;
+    int noFileCommands;  // Commands that write files (Save) are answered INVALID
+};
+
+//Global Variables//
+
+// The command registry is shared by every state; it is filled once and only read afterwards.
+
+static const char* commandKindNames[WITCHER_COMMAND_KINDS] = { // Indexed by CommandKind
+    "invalid", "exit", "loot", "trade", "brew", "learn effective", "learn formula", "encounter", "save",
+    "query effective", "query ingredient", "query potion", "query trophy", "query formula", "query stats",
+    "query brewable", "bulk brew", "query how many", "query countered", "query uses",
+    "query defeatable"
+};
+
+static Arena registryArena;
+static Table commandSpecs = {.arena = &registryArena, .recordSize = sizeof(CommandSpec)};
+static KeywordTrie actionKeywords = {.foldCase = 0};
+static KeywordTrie queryKeywords = {.foldCase = 1};
+
+//Memory Functions//
+
+// realloc that terminates the program instead of returning NULL.
+static void* xrealloc(void* ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Returns zeroed, 16-byte aligned memory from the arena.
+static void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock* head = arena->blocks;
+    if (!head || head->used + size > head->size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* block = xrealloc(NULL, sizeof(ArenaBlock) + blockSize + 15);
+        block->used = (16 - (size_t)(uintptr_t)block->data % 16) % 16;
+        block->size = blockSize + block->used;
+        block->next = head;
+        arena->blocks = head = block;
+    }
+    void* ptr = head->data + head->used;
+    head->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+static void arenaFree(Arena* arena) {
+    while (arena->blocks) {
+        ArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+static void initTable(Table* table, Arena* arena, size_t recordSize) {
+    memset(table, 0, sizeof(*table));
+    table->arena = arena;
+    table->recordSize = recordSize;
+}
+
+// Returns the address of record i; i must be below table->count.
+static void* tableAt(Table* table, int i) {
+    return table->chunks[i / TABLE_CHUNK] + (size_t)(i % TABLE_CHUNK) * table->recordSize;
+}
+
+// Hands out a new zeroed record at index table->count, adding a chunk when the last one is full.
+static int tableAppend(Table* table) {
+    if (table->count == table->chunkCount * TABLE_CHUNK) {
+        if (table->chunkCount == table->chunkCap) {
+            table->chunkCap = table->chunkCap ? table->chunkCap * 2 : 8;
+            table->chunks = xrealloc(table->chunks, table->chunkCap * sizeof(char*));
+        }
+        table->chunks[table->chunkCount++] = arenaAlloc(table->arena, TABLE_CHUNK * table->recordSize);
+    }
+    return table->count++;
+}
+
+static void releaseSlot(Table* freeList, int slot) {
+    *(int*)tableAt(freeList, tableAppend(freeList)) = slot;
+}
+
+static Sym* itemNameAt(WitcherState* w, int i) {
+    return (Sym*)tableAt(&w->itemNames, i);
+}
+
+static int* itemQuantityAt(WitcherState* w, int i) {
+    return (int*)tableAt(&w->itemQuantities, i);
+}
+
+static unsigned char* itemCategoryAt(WitcherState* w, int i) {
+    return (unsigned char*)tableAt(&w->itemCategories, i);
+}
+
+static SortKey* itemSortKeyAt(WitcherState* w, int i) {
+    return (SortKey*)tableAt(&w->itemSortKeys, i);
+}
+
+static Sym* trophyMonsterAt(WitcherState* w, int i) {
+    return (Sym*)tableAt(&w->trophyMonsters, i);
+}
+
+static int* trophyQuantityAt(WitcherState* w, int i) {
+    return (int*)tableAt(&w->trophyQuantities, i);
+}
+
+static SortKey* trophySortKeyAt(WitcherState* w, int i) {
+    return (SortKey*)tableAt(&w->trophySortKeys, i);
+}
+
+// Returns a slot released into freeList if there is one, otherwise a new slot appended to every
+// column; the columns always hold the same number of records.
+static int takeColumnSlot(Table** columns, int columnCount, Table* freeList) {
+    if (freeList->count > 0)
+        return *(int*)tableAt(freeList, --freeList->count);
+    int slot = tableAppend(columns[0]);
+    for (int c = 1; c < columnCount; c++)
+        tableAppend(columns[c]);
+    return slot;
+}
+
+static Formula* formulaAt(WitcherState* w, int i) {
+    return (Formula*)tableAt(&w->formulaBook, i);
+}
+
+static BestiaryEntry* bestiaryAt(WitcherState* w, int i) {
+    return (BestiaryEntry*)tableAt(&w->bestiary, i);
+}
+
+// Appends printf-style text to a response, growing its buffer as needed.
+static void outPrintf(WitcherOutput* out, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = out->cap - out->len;
+        va_start(args, format);
+        int n = vsnprintf(out->text ? out->text + out->len : NULL, room, format, args);
+        va_end(args);
+        if (n < 0)
+            return;
+        if ((size_t)n < room) {
+            out->len += n;
+            return;
+        }
+        size_t cap = out->cap ? out->cap * 2 : 256;
+        while (cap - out->len <= (size_t)n)
+            cap *= 2;
+        out->text = xrealloc(out->text, cap);
+        out->cap = cap;
+    }
+}
+
+//Name Kernels//
+
+// Case-folded comparison and plain substring search. Folding only maps 'A'-'Z' to 'a'-'z', which is
+// all tolower does in the C locale the tracker runs in, so every kernel answers exactly like the
+// strcasecmp, strncasecmp or byte loop it replaces. Stored names are NUL-terminated inside
+// MAX_NAME_LEN-byte fields, so the vector kernels may load the whole field. The SSE2 and AVX2
+// variants are picked once at run time; the scalar ones are the fallback and the reference.
+
+static char emptyName[MAX_NAME_LEN]; // Field of the "no name" symbol
+
+static unsigned char foldByte(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Like strcasecmp on two names stored in MAX_NAME_LEN-byte fields.
+static int foldCompareScalar(const char* a, const char* b) {
+    for (int i = 0; i < MAX_NAME_LEN; i++) {
+        unsigned char x = foldByte(a[i]), y = foldByte(b[i]);
+        if (x != y || x == 0)
+            return x - y;
+    }
+    return 0;
+}
+
+// Like strncasecmp(a, b, len) == 0 for len bytes without NULs; a and b may be any text.
+static int foldEqualScalar(const char* a, const char* b, int len) {
+    for (int i = 0; i < len; i++) {
+        if (foldByte(a[i]) != foldByte(b[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// Returns the first occurrence of needle within [start, end), or NULL.
+static const char* findTextScalar(const char* start, const char* end, const char* needle) {
+    size_t len = strlen(needle);
+    for (; end - start >= (ptrdiff_t)len; start++) {
+        if (*start == *needle && memcmp(start, needle, len) == 0)
+            return start;
+    }
+    return NULL;
+}
+
+#ifdef NAME_KERNELS_X86
+
+// Folds 16 bytes at once: shifting 'A'-'Z' down to the bottom of the signed range makes them the
+// only bytes below -128 + 26.
+__attribute__((target("sse2"))) static inline __m128i foldSse2(__m128i v) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(128 - 'A')));
+    __m128i upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + 26)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+__attribute__((target("avx2"))) static inline __m256i foldAvx2(__m256i v) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char)(128 - 'A')));
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)), shifted);
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+
+// Stops at the first byte where the folded names differ or a ends, as strcasecmp does.
+__attribute__((target("sse2"))) static int foldCompareSse2(const char* a, const char* b) {
+    for (int i = 0; i < MAX_NAME_LEN; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i same = _mm_cmpeq_epi8(foldSse2(x), foldSse2(y));
+        __m128i end = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+        unsigned int stop = (_mm_movemask_epi8(same) ^ 0xFFFF) | _mm_movemask_epi8(end);
+        if (stop) {
+            int at = i + __builtin_ctz(stop);
+            return foldByte(a[at]) - foldByte(b[at]);
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("avx2"))) static int foldCompareAvx2(const char* a, const char* b) {
+    for (int i = 0; i < MAX_NAME_LEN; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i same = _mm256_cmpeq_epi8(foldAvx2(x), foldAvx2(y));
+        __m256i end = _mm256_cmpeq_epi8(x, _mm256_setzero_si256());
+        unsigned int stop = ~(unsigned int)_mm256_movemask_epi8(same) | (unsigned int)_mm256_movemask_epi8(end);
+        if (stop) {
+            int at = i + __builtin_ctz(stop);
+            return foldByte(a[at]) - foldByte(b[at]);
+        }
+    }
+    return 0;
+}
+
+// The vector equality kernels take a stored name field as a and len < MAX_NAME_LEN. They never read
+// b past len: a length that is not a whole number of vectors ends with one more vector that
+// overlaps the previous one, and names shorter than a vector are compared a byte at a time.
+__attribute__((target("sse2"))) static inline int foldEqualBlockSse2(const char* a, const char* b) {
+    __m128i x = _mm_loadu_si128((const __m128i*)a);
+    __m128i y = _mm_loadu_si128((const __m128i*)b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(foldSse2(x), foldSse2(y))) == 0xFFFF;
+}
+
+__attribute__((target("sse2"))) static int foldEqualSse2(const char* a, const char* b, int len) {
+    if (len < 16)
+        return foldEqualScalar(a, b, len);
+    for (int i = 0; i + 16 <= len; i += 16) {
+        if (!foldEqualBlockSse2(a + i, b + i))
+            return 0;
+    }
+    return len % 16 == 0 || foldEqualBlockSse2(a + len - 16, b + len - 16);
+}
+
+__attribute__((target("avx2"))) static inline int foldEqualBlockAvx2(const char* a, const char* b) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)a);
+    __m256i y = _mm256_loadu_si256((const __m256i*)b);
+    return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(foldAvx2(x), foldAvx2(y))) == 0xFFFFFFFFu;
+}
+
+__attribute__((target("avx2"))) static int foldEqualAvx2(const char* a, const char* b, int len) {
+    if (len < 32)
+        return foldEqualSse2(a, b, len);
+    for (int i = 0; i + 32 <= len; i += 32) {
+        if (!foldEqualBlockAvx2(a + i, b + i))
+            return 0;
+    }
+    return len % 32 == 0 || foldEqualBlockAvx2(a + len - 32, b + len - 32);
+}
+
+// Substring search that tests 16 starting positions at a time against the needle's first and last
+// bytes and only compares the candidates that match both, in order.
+__attribute__((target("sse2"))) static const char* findTextSse2(const char* start, const char* end,
+                                                               const char* needle) {
+    size_t len = strlen(needle);
+    if (len < 2)
+        return findTextScalar(start, end, needle);
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[len - 1]);
+    for (; end - start >= (ptrdiff_t)(len + 15); start += 16) {
+        __m128i head = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*)start));
+        __m128i tail = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i*)(start + len - 1)));
+        for (unsigned int hits = _mm_movemask_epi8(_mm_and_si128(head, tail)); hits; hits &= hits - 1) {
+            const char* at = start + __builtin_ctz(hits);
+            if (memcmp(at + 1, needle + 1, len - 2) == 0)
+                return at;
+        }
+    }
+    return findTextScalar(start, end, needle);
+}
+
+__attribute__((target("avx2"))) static const char* findTextAvx2(const char* start, const char* end,
+                                                               const char* needle) {
+    size_t len = strlen(needle);
+    if (len < 2)
+        return findTextScalar(start, end, needle);
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[len - 1]);
+    for (; end - start >= (ptrdiff_t)(len + 31); start += 32) {
+        __m256i head = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)start));
+        __m256i tail = _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i*)(start + len - 1)));
+        unsigned int hits = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(head, tail));
+        for (; hits; hits &= hits - 1) {
+            const char* at = start + __builtin_ctz(hits);
+            if (memcmp(at + 1, needle + 1, len - 2) == 0)
+                return at;
+        }
+    }
+    return findTextScalar(start, end, needle);
+}
+
+#endif
+
+// The kernels in use; scalar until initNameKernels has looked at the CPU.
+static int (*foldCompare)(const char* a, const char* b) = foldCompareScalar;
+static int (*foldEqual)(const char* a, const char* b, int len) = foldEqualScalar;
+static const char* (*findText)(const char* start, const char* end, const char* needle) = findTextScalar;
+
+static void selectNameKernels(void) {
+#ifdef NAME_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        foldCompare = foldCompareAvx2;
+        foldEqual = foldEqualAvx2;
+        findText = findTextAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        foldCompare = foldCompareSse2;
+        foldEqual = foldEqualSse2;
+        findText = findTextSse2;
+    }
+#endif
+}
+
+static void initNameKernels(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, selectNameKernels);
+}
+
+// The first eight bytes of a name, folded, as a big-endian integer padded with NULs: keys order
+// like the names they come from, and equal keys only leave longer names undecided.
+static SortKey sortKeyOf(const char* name) {
+    SortKey key = 0;
+    int ended = 0;
+    for (int i = 0; i < 8; i++) {
+        ended = ended || name[i] == '\0';
+        key = key << 8 | (ended ? 0 : foldByte(name[i]));
+    }
+    return key;
+}
+
+//Utility Functions//
+
+// Whitespace test for raw input bytes, safe for bytes above 127.
+static int isSpaceChar(char c) {
+    return isspace((unsigned char)c);
+}
+
+// Returns [start, end) without its leading and trailing whitespace; nothing is copied.
+static Slice trimSlice(const char* start, const char* end) {
+    while (start < end && isSpaceChar(*start)) start++;
+    while (end > start && isSpaceChar(end[-1])) end--;
+    return (Slice){start, (int)(end - start)};
+}
+
+// Shortens a slice to at most maxLen characters, the way copying into a fixed buffer used to.
+static Slice clipSlice(Slice text, int maxLen) {
+    if (text.len > maxLen)
+        text.len = maxLen;
+    return text;
+}
+
+// Case-sensitive prefix test on [start, end).
+static int startsWith(const char* start, const char* end, const char* prefix) {
+    size_t len = strlen(prefix);
+    return end - start >= (ptrdiff_t)len && memcmp(start, prefix, len) == 0;
+}
+
+static int endsWithQuestionMark(Slice text) {  // Check if the text (already trimmed) ends with a '?' character.
+    return text.len > 0 && text.text[text.len - 1] == '?';
+}
+
+static long long monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// FNV-1a over 64-bit words; len must be a multiple of 8.
+static uint64_t blockChecksum(const char* data, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//Symbol Table//
+
+// FNV-1a hash of the case-folded name, so names that differ only in case land in the same slot.
+static unsigned int hashName(Slice name) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < name.len; i++) {
+        hash ^= foldByte(name.text[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static Symbol* symAt(WitcherState* w, Sym sym) {
+    return (Symbol*)tableAt(&w->symbols, sym);
+}
+
+// Returns the spelling of an interned name; "no name" reads as the empty string.
+static const char* symName(WitcherState* w, Sym sym) {
+    return sym ? symAt(w, sym)->text : emptyName;
+}
+
+static Slice symSlice(WitcherState* w, Sym sym) {
+    return sym ? (Slice){symAt(w, sym)->text, symAt(w, sym)->length} : (Slice){emptyName, 0};
+}
+
+// Returns the id shared by every spelling of the same case-folded name.
+static Sym symKey(WitcherState* w, Sym sym) {
+    return sym ? symAt(w, sym)->key : 0;
+}
+
+// Places a key symbol into the first free slot of its probe sequence.
+static void symbolIndexInsert(WitcherState* w, Sym sym, unsigned int hash) {
+    int mask = w->symbolIndexCap - 1;
+    int i = hash & mask;
+    while (w->symbolIndex[i].sym != 0)
+        i = (i + 1) & mask;
+    w->symbolIndex[i].hash = hash;
+    w->symbolIndex[i].sym = sym;
+    w->symbolIndexCount++;
+}
+
+// Doubles the index and rehashes it so that it stays at most half full.
+static void growSymbolIndex(WitcherState* w) {
+    IndexSlot* old = w->symbolIndex;
+    int oldCap = w->symbolIndexCap;
+    w->symbolIndexCap = oldCap ? oldCap * 2 : 256;
+    w->symbolIndex = xrealloc(NULL, w->symbolIndexCap * sizeof(IndexSlot));
+    w->symbolIndexCount = 0;
+    memset(w->symbolIndex, 0, w->symbolIndexCap * sizeof(IndexSlot));
+    for (int i = 0; i < oldCap; i++) {
+        if (old[i].sym != 0)
+            symbolIndexInsert(w, old[i].sym, old[i].hash);
+    }
+    free(old);
+}
+
+// Looks up an already clipped name; returns its key symbol, or 0 if no spelling was ever interned.
+static Sym findClippedSym(WitcherState* w, Slice name, unsigned int hash) {
+    if (w->symbolIndexCap == 0)
+        return 0;
+    int mask = w->symbolIndexCap - 1;
+    for (int i = hash & mask; w->symbolIndex[i].sym != 0; i = (i + 1) & mask) {
+        Symbol* symbol = symAt(w, w->symbolIndex[i].sym);
+        if (w->symbolIndex[i].hash == hash && symbol->length == name.len &&
+            foldEqual(symbol->text, name.text, name.len))
+            return w->symbolIndex[i].sym;
+    }
+    return 0;
+}
+
+// Returns the key symbol for a name without interning it, or 0 if the name is unknown.
+// Names are clipped to MAX_NAME_LEN - 1 characters, the length stored names always had.
+static Sym findSym(WitcherState* w, Slice name) {
+    name = clipSlice(name, MAX_NAME_LEN - 1);
+    return findClippedSym(w, name, hashName(name));
+}
+
+// Returns the symbol for this exact spelling, interning it (and its case-folded key) if needed.
+static Sym intern(WitcherState* w, Slice name) {
+    name = clipSlice(name, MAX_NAME_LEN - 1);
+    unsigned int hash = hashName(name);
+    Sym key = findClippedSym(w, name, hash);
+    Sym last = 0;
+    for (Sym sym = key; sym != 0; sym = symAt(w, sym)->nextSpelling) {
+        if (symAt(w, sym)->length == name.len && memcmp(symAt(w, sym)->text, name.text, name.len) == 0)
+            return sym;
+        last = sym;
+    }
+    if (w->symbols.count == 0)
+        tableAppend(&w->symbols); // Reserve id 0
+    Sym sym = tableAppend(&w->symbols);
+    Symbol* symbol = symAt(w, sym);
+    memcpy(symbol->text, name.text, name.len);
+    symbol->text[name.len] = '\0';
+    symbol->sortKey = sortKeyOf(symbol->text);
+    symbol->length = name.len;
+    symbol->hash = hash;
+    symbol->item = -1;
+    symbol->trophy = -1;
+    symbol->formula = -1;
+    symbol->monster = -1;
+    symbol->firstUse = -1;
+    symbol->firstCounter = -1;
+    if (key) {
+        symbol->key = key;
+        symAt(w, last)->nextSpelling = sym;
+    } else {
+        symbol->key = sym;
+        if ((w->symbolIndexCount + 1) * 2 > w->symbolIndexCap)
+            growSymbolIndex(w);
+        symbolIndexInsert(w, sym, hash);
+    }
+    return sym;
+}
+
+//Sorting Helpers//
+
+// Orders two stored names by their sort keys, reading the text only when the keys tie on names of
+// eight or more bytes. Agrees in sign with strcasecmp.
+static int compareSortKeys(SortKey a, SortKey b, const char* aName, const char* bName) {
+    if (a != b)
+        return a < b ? -1 : 1;
+    return (a & 0xFF) ? foldCompare(aName, bName) : 0;
+}
+
+// Listing order for ingredients and potions (case-insensitive by item name)
+static int itemOrder(WitcherState* w, int a, int b) {
+    return compareSortKeys(*itemSortKeyAt(w, a), *itemSortKeyAt(w, b), symName(w, *itemNameAt(w, a)),
+                           symName(w, *itemNameAt(w, b)));
+}
+
+// Listing order for trophies (case-insensitive by monster name)
+static int trophyOrder(WitcherState* w, int a, int b) {
+    return compareSortKeys(*trophySortKeyAt(w, a), *trophySortKeyAt(w, b), symName(w, *trophyMonsterAt(w, a)),
+                           symName(w, *trophyMonsterAt(w, b)));
+}
+
+// Listing order for bestiary entries (case-insensitive by monster name)
+static int monsterOrder(WitcherState* w, int a, int b) {
+    Sym aName = bestiaryAt(w, a)->monsterName, bName = bestiaryAt(w, b)->monsterName;
+    return compareSortKeys(symAt(w, aName)->sortKey, symAt(w, bName)->sortKey, symName(w, aName), symName(w, bName));
+}
+
+// Listing order for brewable potions (case-insensitive by potion name)
+static int formulaOrder(WitcherState* w, int a, int b) {
+    Sym aName = formulaAt(w, a)->potionName, bName = formulaAt(w, b)->potionName;
+    return compareSortKeys(symAt(w, aName)->sortKey, symAt(w, bName)->sortKey, symName(w, aName), symName(w, bName));
+}
+
+// Sorts items by order with a bottom-up merge sort.
+static void sortItems(WitcherState* w, int* items, int count, int (*order)(WitcherState*, int, int)) {
+    if (count < 2)
+        return;
+    int* scratch = xrealloc(NULL, count * sizeof(int));
+    int* from = items;
+    int* to = scratch;
+    for (int width = 1; width < count; width *= 2) {
+        for (int lo = 0; lo < count; lo += 2 * width) {
+            int mid = lo + width < count ? lo + width : count;
+            int hi = lo + 2 * width < count ? lo + 2 * width : count;
+            int a = lo, b = mid, k = lo;
+            while (a < mid && b < hi)
+                to[k++] = order(w, from[b], from[a]) < 0 ? from[b++] : from[a++];
+            while (a < mid)
+                to[k++] = from[a++];
+            while (b < hi)
+                to[k++] = from[b++];
+        }
+        int* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != items)
+        memcpy(items, from, count * sizeof(int));
+    free(scratch);
+}
+
+// Order of formula components: quantity descending, then name
+static int compareComponents(WitcherState* w, const Component* a, const Component* b) {
+    if (a->quantity != b->quantity) {
+        return b->quantity - a->quantity; //descending
+    }
+    return compareSortKeys(symAt(w, a->name)->sortKey, symAt(w, b->name)->sortKey, symName(w, a->name),
+                           symName(w, b->name));
+}
+
+//Sorted Views//
+
+static void initView(SortedView* view, WitcherState* owner, int (*compare)(WitcherState*, int, int)) {
+    memset(view, 0, sizeof(*view));
+    view->owner = owner;
+    view->compare = compare;
+}
+
+// Returns a level in [1, VIEW_MAX_LEVEL]; each level is half as likely as the one below it.
+static int randomViewLevel(WitcherState* w) {
+    unsigned int state = w->viewLevelState; // xorshift32, fixed seed keeps runs reproducible
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    w->viewLevelState = state;
+    int level = 1;
+    for (unsigned int bits = state; (bits & 1) && level < VIEW_MAX_LEVEL; bits >>= 1)
+        level++;
+    return level;
+}
+
+static ViewNode* allocViewNode(WitcherState* w, int level) {
+    ViewNode* node = w->freeViewNodes[level];
+    if (node)
+        w->freeViewNodes[level] = node->next[0];
+    else
+        node = arenaAlloc(&w->arena, sizeof(ViewNode) + level * sizeof(ViewNode*));
+    memset(node->next, 0, level * sizeof(ViewNode*));
+    node->level = level;
+    return node;
+}
+
+// Orders two slots by the view's comparison, falling back to slot order so that no two slots tie.
+static int viewCompare(SortedView* view, int a, int b) {
+    int order = view->compare(view->owner, a, b);
+    return order ? order : a - b;
+}
+
+// Fills update[] with the rightmost node before the item's position on every level in use.
+static void viewSearch(SortedView* view, int item, ViewNode** update) {
+    ViewNode* node = view->head;
+    for (int l = view->level - 1; l >= 0; l--) {
+        while (node->next[l] && viewCompare(view, node->next[l]->item, item) < 0)
+            node = node->next[l];
+        update[l] = node;
+    }
+}
+
+// Links the slot order a snapshot left for the view, in one pass and without comparisons.
+static void ensureView(SortedView* view) {
+    if (!view->pending)
+        return;
+    const int* order = view->pending;
+    ViewNode* last[VIEW_MAX_LEVEL];
+    view->pending = NULL;
+    view->head = allocViewNode(view->owner, VIEW_MAX_LEVEL);
+    view->level = 1;
+    for (int l = 0; l < VIEW_MAX_LEVEL; l++)
+        last[l] = view->head;
+    for (int i = 0; i < view->count; i++) {
+        ViewNode* node = allocViewNode(view->owner, randomViewLevel(view->owner));
+        node->item = order[i];
+        for (int l = 0; l < node->level; l++) {
+            last[l]->next[l] = node;
+            last[l] = node;
+        }
+        if (node->level > view->level)
+            view->level = node->level;
+    }
+}
+
+// Returns the first node in listing order, or NULL for an empty view.
+static ViewNode* viewFirst(SortedView* view) {
+    ensureView(view);
+    return view->head ? view->head->next[0] : NULL;
+}
+
+static void viewInsert(SortedView* view, int item) {
+    ensureView(view);
+    if (!view->head) {
+        view->head = allocViewNode(view->owner, VIEW_MAX_LEVEL);
+        view->level = 1;
+    }
+    ViewNode* update[VIEW_MAX_LEVEL];
+    viewSearch(view, item, update);
+    int level = randomViewLevel(view->owner);
+    for (; view->level < level; view->level++)
+        update[view->level] = view->head;
+    ViewNode* node = allocViewNode(view->owner, level);
+    node->item = item;
+    for (int l = 0; l < level; l++) {
+        node->next[l] = update[l]->next[l];
+        update[l]->next[l] = node;
+    }
+    view->count++;
+}
+
+// Unlinks an item; its name must still be set so the search can find its position.
+static void viewRemove(SortedView* view, int item) {
+    ViewNode* update[VIEW_MAX_LEVEL];
+    ensureView(view);
+    viewSearch(view, item, update);
+    ViewNode* node = update[0]->next[0];
+    for (int l = 0; l < node->level; l++)
+        update[l]->next[l] = node->next[l];
+    node->next[0] = view->owner->freeViewNodes[node->level];
+    view->owner->freeViewNodes[node->level] = node;
+    view->count--;
+}
+
+//Formula & Bestiary Lookup//
+
+// Returns the formula book index for a potion, or -1 if no formula is known.
+static int findFormula(WitcherState* w, Sym potion) {
+    return potion ? symAt(w, symKey(w, potion))->formula : -1;
+}
+
+// Returns the bestiary index for a monster, or -1 if it has no entry.
+static int findMonster(WitcherState* w, Sym monster) {
+    return monster ? symAt(w, symKey(w, monster))->monster : -1;
+}
+
+//Classification Helpers//
+
+//An item is a potion if its name matches one of the known potion formulas, otherwise an ingredient.
+static ItemCategory classifyItem(WitcherState* w, Sym name) {
+    return findFormula(w, name) != -1 ? ITEM_POTION : ITEM_INGREDIENT;
+}
+
+//Journal//
+
+// Terminates the program: once a mutation cannot be made durable, carrying on would lose it silently.
+static void journalFailed(const char* what) {
+    fprintf(stderr, "Journal %s failed: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void journalBytes(Journal* journal, const void* data, size_t len) {
+    if (journal->used + len > journal->cap) {
+        journal->cap = journal->cap ? journal->cap * 2 : JOURNAL_GROUP_BYTES * 2;
+        journal->frame = xrealloc(journal->frame, journal->cap);
+    }
+    memcpy(journal->frame + journal->used, data, len);
+    journal->used += len;
+}
+
+static void journalInt(Journal* journal, int value) {
+    journalBytes(journal, &value, sizeof(value));
+}
+
+static void journalName(WitcherState* w, Sym name) {
+    unsigned char len = symAt(w, name)->length;
+    journalBytes(&w->journal, &len, 1);
+    journalBytes(&w->journal, symName(w, name), len);
+}
+
+// Returns the campaign id, choosing one the first time a snapshot or journal needs it.
+static uint64_t journalCampaign(Journal* journal) {
+    while (journal->campaign == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t seed = ((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec ^ ((uint64_t)getpid() << 16) ^ (uintptr_t)journal;
+        seed ^= seed >> 33;
+        seed *= 0xff51afd7ed558ccdull;
+        seed ^= seed >> 33;
+        journal->campaign = seed;
+    }
+    return journal->campaign;
+}
+
+// Counts a mutation and starts its record. Returns 0 when the fields should not be written because
+// journaling is off or the mutation is itself being replayed.
+static int journalBegin(Journal* journal, JournalOp op) {
+    journal->seq++;
+    if (journal->fd < 0 || journal->replaying)
+        return 0;
+    if (journal->records == 0) {
+        journal->used = 0;
+        journalBytes(journal, &(JournalFrame){0}, sizeof(JournalFrame));
+        journal->firstSeq = journal->seq;
+        journal->firstNs = monotonicNs();
+    }
+    journal->records++;
+    unsigned char byte = op;
+    journalBytes(journal, &byte, 1);
+    return 1;
+}
+
+// Writes the waiting records as one frame and syncs the file.
+static void journalCommit(Journal* journal) {
+    if (journal->fd < 0 || journal->records == 0)
+        return;
+    static const char padding[8];
+    journalBytes(journal, padding, (8 - journal->used % 8) % 8);
+    JournalFrame header = {0, JOURNAL_MAGIC, (uint32_t)(journal->used - sizeof(JournalFrame)),
+                           journalCampaign(journal), journal->firstSeq, journal->records, 0};
+    memcpy(journal->frame, &header, sizeof(header));
+    header.checksum = blockChecksum(journal->frame + 8, journal->used - 8);
+    memcpy(journal->frame, &header.checksum, 8);
+    for (size_t done = 0; done < journal->used;) {
+        ssize_t n = write(journal->fd, journal->frame + done, journal->used - done);
+        if (n < 0 && errno != EINTR)
+            journalFailed("write");
+        if (n > 0)
+            done += n;
+    }
+    if (fdatasync(journal->fd) != 0)
+        journalFailed("sync");
+    journal->records = 0;
+}
+
+// Group commit: called between commands, commits once enough records or time have piled up.
+static void journalTick(Journal* journal) {
+    if (journal->records > 0 &&
+        (journal->used >= JOURNAL_GROUP_BYTES || monotonicNs() - journal->firstNs >= JOURNAL_GROUP_MS * 1000000LL))
+        journalCommit(journal);
+}
+
+//Encounter Readiness//
+// One bit per bestiary entry says whether Geralt could defeat the monster now: its sign is known or its
+// potion is in stock. Bits change when an entry is learned or updated and when a potion's stock
+// becomes or stops being zero.
+
+static uint64_t* readyWordAt(WitcherState* w, int entry) {
+    return (uint64_t*)tableAt(&w->readyWords, entry / 64);
+}
+
+static int isReady(WitcherState* w, int entry) {
+    return (*readyWordAt(w, entry) >> (entry % 64)) & 1;
+}
+
+static void refreshReady(WitcherState* w, int entry) {
+    BestiaryEntry* e = bestiaryAt(w, entry);
+    int item = e->effectivePotion ? symAt(w, symKey(w, e->effectivePotion))->item : -1;
+    int ready = e->effectiveSign || (item != -1 && *itemQuantityAt(w, item) > 0);
+    uint64_t bit = (uint64_t)1 << (entry % 64);
+    if (ready)
+        *readyWordAt(w, entry) |= bit;
+    else
+        *readyWordAt(w, entry) &= ~bit;
+}
+
+// Refreshes the monsters a potion counters after its stock became or stopped being zero.
+static void refreshCountered(WitcherState* w, Symbol* potion) {
+    for (CounterLink link = potion->firstCounter; link != -1; link = bestiaryAt(w, link / 2)->nextCounter[link % 2]) {
+        if (link % 2 == 0)
+            refreshReady(w, link / 2);
+    }
+}
+
+// Returns the bestiary entries Geralt could defeat now, by monster name, in a buffer the caller frees;
+// *count is how many. Only the set bits of the bitmap are visited.
+static int* readyMonsters(WitcherState* w, int* count) {
+    int ready = 0;
+    for (int i = 0; i < w->readyWords.count; i++)
+        ready += __builtin_popcountll(*(uint64_t*)tableAt(&w->readyWords, i));
+    int* entries = xrealloc(NULL, (ready > 0 ? ready : 1) * sizeof(int));
+    int n = 0;
+    for (int i = 0; i < w->readyWords.count; i++) {
+        for (uint64_t word = *(uint64_t*)tableAt(&w->readyWords, i); word; word &= word - 1)
+            entries[n++] = i * 64 + __builtin_ctzll(word);
+    }
+    sortItems(w, entries, n, monsterOrder);
+    *count = n;
+    return entries;
+}
+
+//Craftability Index//
+// Every formula keeps how many times the inventory could brew it, and the ones it could brew now stay
+// in brewableView. Only the formulas using an ingredient are revisited when its quantity changes.
+
+// Returns how much of component i's ingredient one brew takes in all, or 0 when an earlier component
+// names the same ingredient, so each ingredient is counted once.
+static long long ingredientTotal(const Formula* f, int i) {
+    long long total = 0;
+    for (int j = 0; j < f->componentCount; j++) {
+        if (f->keys[j] != f->keys[i])
+            continue;
+        if (j < i)
+            return 0;
+        total += f->components[j].quantity;
+    }
+    return total;
+}
+
+// Recomputes how many times the formula could be brewed, moving it in or out of brewableView.
+static void refreshBrewable(WitcherState* w, int formula) {
+    Formula* f = formulaAt(w, formula);
+    Sym potion = symKey(w, f->potionName);
+    long long brewable = INT_MAX;
+    for (int i = 0; i < f->componentCount && brewable > 0; i++) {
+        long long total = ingredientTotal(f, i);
+        if (total == 0)
+            continue;
+        int item = symAt(w, f->keys[i])->item;
+        long long have = item != -1 ? *itemQuantityAt(w, item) : 0;
+        long long times = have / total;
+        // A formula using its own potion gets one back from every brew, so the stock only has to
+        // cover the first brew in full and then total - 1 per brew after it.
+        if (f->keys[i] == potion)
+            times = have < total ? 0 : total == 1 ? INT_MAX : (have - 1) / (total - 1);
+        if (times < brewable)
+            brewable = times;
+    }
+    if (f->componentCount == 0)
+        brewable = 0;
+    if ((brewable > 0) != (f->brewable > 0)) {
+        if (brewable > 0)
+            viewInsert(&w->brewableView, formula);
+        else
+            viewRemove(&w->brewableView, formula);
+    }
+    f->brewable = (int)brewable;
+}
+
+// Refreshes every formula with a component naming the ingredient whose key symbol is given.
+static void refreshUses(WitcherState* w, Symbol* ingredient) {
+    for (UseLink link = ingredient->firstUse; link != -1;) {
+        Formula* f = formulaAt(w, link / MAX_COMPONENTS);
+        refreshBrewable(w, link / MAX_COMPONENTS);
+        link = f->nextUse[link % MAX_COMPONENTS];
+    }
+}
+
+// Links a newly learned formula's components into their ingredients' use lists, which stay in potion
+// name order so "Which formulas use" is a walk of one list.
+static void linkUses(WitcherState* w, int formula) {
+    Formula* f = formulaAt(w, formula);
+    for (int i = 0; i < f->componentCount; i++) {
+        UseLink* at = &symAt(w, f->keys[i])->firstUse;
+        while (*at != -1 && formulaOrder(w, *at / MAX_COMPONENTS, formula) <= 0)
+            at = &formulaAt(w, *at / MAX_COMPONENTS)->nextUse[*at % MAX_COMPONENTS];
+        f->nextUse[i] = *at;
+        *at = formula * MAX_COMPONENTS + i;
+    }
+    f->brewable = 0;
+    refreshBrewable(w, formula);
+}
+
+//Inventory Functions//
+
+// Returns the inventory slot holding the name, or -1 if it is not in the inventory.
+static int findItem(WitcherState* w, Sym name) {
+    return name ? symAt(w, symKey(w, name))->item : -1;
+}
+
+//Adds or updates an item in the inventory.
+static void addItem(WitcherState* w, Sym name, int quantity) {
+    if (journalBegin(&w->journal, JOURNAL_ADD_ITEM)) {
+        journalName(w, name);
+        journalInt(&w->journal, quantity);
+    }
+    w->versions[DATA_INVENTORY]++;
+    Symbol* key = symAt(w, symKey(w, name));
+    if (key->item != -1) {
+        int* have = itemQuantityAt(w, key->item);
+        int wasInStock = *have > 0;
+        *have += quantity;
+        refreshUses(w, key);
+        if ((*have > 0) != wasInStock)
+            refreshCountered(w, key);
+        return;
+    }
+    Table* columns[] = {&w->itemNames, &w->itemQuantities, &w->itemCategories, &w->itemSortKeys};
+    int index = takeColumnSlot(columns, 4, &w->freeItems);
+    ItemCategory category = classifyItem(w, name);
+    *itemNameAt(w, index) = name;
+    *itemQuantityAt(w, index) = quantity;
+    *itemCategoryAt(w, index) = category;
+    *itemSortKeyAt(w, index) = symAt(w, name)->sortKey;
+    key->item = index;
+    viewInsert(&w->itemViews[category], index);
+    refreshUses(w, key);
+    refreshCountered(w, key);
+    if (w->itemNames.count - w->freeItems.count > w->stats.peakItems)
+        w->stats.peakItems = w->itemNames.count - w->freeItems.count;
+}
+
+//Removes a given quantity of the item in an inventory slot.
+//An item that runs out is unbound from its name and its slot is queued for reuse.
+static int removeItemAt(WitcherState* w, int index, int quantity) {
+    if (*itemQuantityAt(w, index) < quantity)
+        return 0;
+    Sym name = *itemNameAt(w, index);
+    if (journalBegin(&w->journal, JOURNAL_REMOVE_ITEM)) {
+        journalName(w, name);
+        journalInt(&w->journal, quantity);
+    }
+    w->versions[DATA_INVENTORY]++;
+    Symbol* key = symAt(w, symKey(w, name));
+    int* left = itemQuantityAt(w, index);
+    *left -= quantity;
+    if (*left == 0) {
+        viewRemove(&w->itemViews[*itemCategoryAt(w, index)], index);
+        key->item = -1;
+        *itemNameAt(w, index) = 0;
+        releaseSlot(&w->freeItems, index);
+        refreshCountered(w, key);
+    }
+    refreshUses(w, key);
+    return 1;
+}
+
+//Removes a given quantity of an item from the inventory.
+static int removeItem(WitcherState* w, Sym name, int quantity) {
+    int index = findItem(w, name);
+    return index != -1 && removeItemAt(w, index, quantity);
+}
+
+// Returns how many of the named item are in the inventory.
+static int itemQuantity(WitcherState* w, Sym name) {
+    int index = findItem(w, name);
+    return index != -1 ? *itemQuantityAt(w, index) : 0;
+}
+
+//Trophy Functions//
+
+// Returns how many trophies of the monster Geralt holds.
+static int trophyQuantity(WitcherState* w, Sym monster) {
+    int index = monster ? symAt(w, symKey(w, monster))->trophy : -1;
+    return index != -1 ? *trophyQuantityAt(w, index) : 0;
+}
+
+//Adds trophies for a monster; the spelling given here is the one listings show.
+static void addTrophy(WitcherState* w, Sym monster, int quantity) {
+    if (journalBegin(&w->journal, JOURNAL_ADD_TROPHY)) {
+        journalName(w, monster);
+        journalInt(&w->journal, quantity);
+    }
+    w->versions[DATA_TROPHIES]++;
+    Symbol* key = symAt(w, symKey(w, monster));
+    if (key->trophy != -1) {
+        *trophyQuantityAt(w, key->trophy) += quantity;
+        return;
+    }
+    Table* columns[] = {&w->trophyMonsters, &w->trophyQuantities, &w->trophySortKeys};
+    int index = takeColumnSlot(columns, 3, &w->freeTrophies);
+    *trophyMonsterAt(w, index) = monster;
+    *trophyQuantityAt(w, index) = quantity;
+    *trophySortKeyAt(w, index) = symAt(w, monster)->sortKey;
+    key->trophy = index;
+    viewInsert(&w->trophyView, index);
+    if (w->trophyMonsters.count - w->freeTrophies.count > w->stats.peakTrophies)
+        w->stats.peakTrophies = w->trophyMonsters.count - w->freeTrophies.count;
+}
+
+//Removes trophies for a monster, releasing its slot when none are left.
+static int removeTrophy(WitcherState* w, Sym monster, int quantity) {
+    int index = monster ? symAt(w, symKey(w, monster))->trophy : -1;
+    if (index == -1 || *trophyQuantityAt(w, index) < quantity)
+        return 0;
+    if (journalBegin(&w->journal, JOURNAL_REMOVE_TROPHY)) {
+        journalName(w, monster);
+        journalInt(&w->journal, quantity);
+    }
+    w->versions[DATA_TROPHIES]++;
+    int* left = trophyQuantityAt(w, index);
+    *left -= quantity;
+    if (*left == 0) {
+        viewRemove(&w->trophyView, index);
+        symAt(w, symKey(w, *trophyMonsterAt(w, index)))->trophy = -1;
+        *trophyMonsterAt(w, index) = 0;
+        releaseSlot(&w->freeTrophies, index);
+    }
+    return 1;
+}
+
+// Strips a trailing " trophy" (any case) from the slice; returns 0 if the name has no such suffix.
+static int stripTrophySuffix(Slice* name) {
+    if (name->len < 7 || !foldEqualScalar(name->text + name->len - 7, " trophy", 7))
+        return 0;
+    name->len -= 7;
+    return 1;
+}
+
+//Knowledge Functions//
+
+// Links the entry's potion or sign into the list of monsters it counters, keeping monster name order.
+static void linkCounter(WitcherState* w, int entry, int isSign) {
+    BestiaryEntry* e = bestiaryAt(w, entry);
+    Symbol* counter = symAt(w, symKey(w, isSign ? e->effectiveSign : e->effectivePotion));
+    CounterLink link = entry * 2 + isSign, prev = -1, next = counter->firstCounter;
+    while (next != -1 && monsterOrder(w, next / 2, entry) <= 0) {
+        prev = next;
+        next = bestiaryAt(w, next / 2)->nextCounter[next % 2];
+    }
+    e->prevCounter[isSign] = prev;
+    e->nextCounter[isSign] = next;
+    if (prev != -1)
+        bestiaryAt(w, prev / 2)->nextCounter[prev % 2] = link;
+    else
+        counter->firstCounter = link;
+    if (next != -1)
+        bestiaryAt(w, next / 2)->prevCounter[next % 2] = link;
+}
+
+// Takes the entry's potion or sign out of the list of monsters it counters, before it is overwritten.
+static void unlinkCounter(WitcherState* w, int entry, int isSign) {
+    BestiaryEntry* e = bestiaryAt(w, entry);
+    Symbol* counter = symAt(w, symKey(w, isSign ? e->effectiveSign : e->effectivePotion));
+    CounterLink prev = e->prevCounter[isSign], next = e->nextCounter[isSign];
+    if (prev != -1)
+        bestiaryAt(w, prev / 2)->nextCounter[prev % 2] = next;
+    else
+        counter->firstCounter = next;
+    if (next != -1)
+        bestiaryAt(w, next / 2)->prevCounter[next % 2] = prev;
+}
+
+// Records that a sign or potion is effective against a monster, adding its bestiary entry if needed.
+static void learnEffectiveness(WitcherState* w, Sym monster, Sym counter, int isSign) {
+    if (journalBegin(&w->journal, JOURNAL_LEARN_EFFECTIVE)) {
+        journalName(w, monster);
+        journalName(w, counter);
+        journalBytes(&w->journal, &(unsigned char){isSign}, 1);
+    }
+    w->versions[DATA_BESTIARY]++;
+    int index = findMonster(w, monster);
+    if (index == -1) {
+        index = tableAppend(&w->bestiary);
+        *bestiaryAt(w, index) = (BestiaryEntry){monster, 0, 0, {-1, -1}, {-1, -1}};
+        symAt(w, symKey(w, monster))->monster = index;
+        if (index % 64 == 0)
+            *(uint64_t*)tableAt(&w->readyWords, tableAppend(&w->readyWords)) = 0;
+    }
+    BestiaryEntry* e = bestiaryAt(w, index);
+    if (isSign ? e->effectiveSign : e->effectivePotion)
+        unlinkCounter(w, index, isSign);
+    if (isSign)
+        e->effectiveSign = counter;
+    else
+        e->effectivePotion = counter;
+    linkCounter(w, index, isSign);
+    refreshReady(w, index);
+}
+
+// Stores the components, binds each to its key symbol and sorts them into "What is in" order.
+static void compileFormula(WitcherState* w, Formula* f, const Component* components, int componentCount) {
+    memcpy(f->components, components, componentCount * sizeof(Component));
+    for (int i = 0; i < componentCount; i++) {
+        f->keys[i] = symKey(w, components[i].name);
+        int j = i; // Insertion sort; formulas are short
+        for (; j > 0 && compareComponents(w, &components[f->listOrder[j - 1]], &components[i]) > 0; j--)
+            f->listOrder[j] = f->listOrder[j - 1];
+        f->listOrder[j] = (unsigned char)i;
+    }
+    f->componentCount = componentCount;
+}
+
+// Adds a formula for a potion that has none yet.
+static void learnFormula(WitcherState* w, Sym potion, const Component* components, int componentCount) {
+    if (journalBegin(&w->journal, JOURNAL_LEARN_FORMULA)) {
+        journalName(w, potion);
+        journalBytes(&w->journal, &(unsigned char){componentCount}, 1);
+        for (int i = 0; i < componentCount; i++) {
+            journalName(w, components[i].name);
+            journalInt(&w->journal, components[i].quantity);
+        }
+    }
+    w->versions[DATA_FORMULAS]++;
+    int index = tableAppend(&w->formulaBook);
+    Formula* f = formulaAt(w, index);
+    f->potionName = potion;
+    symAt(w, symKey(w, potion))->formula = index;
+    // A potion already in stock was filed as an ingredient until now.
+    int item = findItem(w, potion);
+    if (item != -1) {
+        ItemCategory category = classifyItem(w, *itemNameAt(w, item));
+        if (category != *itemCategoryAt(w, item)) {
+            w->versions[DATA_INVENTORY]++;
+            viewRemove(&w->itemViews[*itemCategoryAt(w, item)], item);
+            *itemCategoryAt(w, item) = category;
+            viewInsert(&w->itemViews[category], item);
+        }
+    }
+    compileFormula(w, f, components, componentCount);
+    linkUses(w, index);
+}
+
+//Campaign Actions//
+// The steps behind each action, shared by the typed calls and the command handlers: they change the
+// state and say what happened, and the caller reports it.
+
+// Adds every entry to the inventory.
+static void lootEntries(WitcherState* w, const ListEntry* items, int count) {
+    for (int i = 0; i < count; i++)
+        addItem(w, intern(w, items[i].name), items[i].quantity);
+}
+
+// Trophies are named "<monster> trophy"; anything else is a trophy Geralt cannot hold (monster 0).
+static Sym tradedMonster(WitcherState* w, Slice name) {
+    return stripTrophySuffix(&name) ? findSym(w, name) : 0;
+}
+
+// Checks that Geralt holds every trophy of a trade list, counting a failed trade if he does not.
+static int haveTrophies(WitcherState* w, const ListEntry* trophyList, int count) {
+    for (int i = 0; i < count; i++) {
+        if (trophyQuantity(w, tradedMonster(w, trophyList[i].name)) < trophyList[i].quantity) {
+            w->stats.failedTrades++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void giveTrophies(WitcherState* w, const ListEntry* trophyList, int count) {
+    for (int i = 0; i < count; i++)
+        removeTrophy(w, tradedMonster(w, trophyList[i].name), trophyList[i].quantity);
+}
+
+// Uses up the potion's ingredients and adds one of the potion. An ingredient named by several
+// components must be in stock for all of them together.
+static WitcherResult brewPotion(WitcherState* w, Slice potion) {
+    int index = findFormula(w, findSym(w, potion));
+    if (index == -1)
+        return WITCHER_NO_FORMULA;
+    Formula* f = formulaAt(w, index);
+    int slots[MAX_COMPONENTS];
+    for (int i = 0; i < f->componentCount; i++) {
+        slots[i] = symAt(w, f->keys[i])->item;
+        if (slots[i] == -1 || *itemQuantityAt(w, slots[i]) < ingredientTotal(f, i)) {
+            w->stats.failedBrews++;
+            return WITCHER_NOT_ENOUGH_INGREDIENTS;
+        }
+    }
+    for (int i = 0; i < f->componentCount; i++)
+        removeItemAt(w, slots[i], f->components[i].quantity);
+    addItem(w, intern(w, potion), 1);
+    return WITCHER_OK;
+}
+
+// Updates or adds the bestiary entry for the enemy.
+static WitcherResult learnCounter(WitcherState* w, Slice counter, int isSign, Slice monster) {
+    int index = findMonster(w, findSym(w, monster));
+    if (index == -1) {
+        learnEffectiveness(w, intern(w, monster), intern(w, counter), isSign);
+        return WITCHER_NEW_ENTRY;
+    }
+    Sym known = isSign ? bestiaryAt(w, index)->effectiveSign : bestiaryAt(w, index)->effectivePotion;
+    if (known && symKey(w, known) == findSym(w, counter))
+        return WITCHER_ALREADY_KNOWN;
+    learnEffectiveness(w, bestiaryAt(w, index)->monsterName, intern(w, counter), isSign);
+    return WITCHER_ENTRY_UPDATED;
+}
+
+// Adds the potion's formula to the formula book if it isn't known already.
+static WitcherResult learnPotionFormula(WitcherState* w, Slice potionName, const ListEntry* entries, int count) {
+    if (findFormula(w, findSym(w, potionName)) != -1)
+        return WITCHER_ALREADY_KNOWN;
+    Sym potion = intern(w, potionName);
+    Component components[MAX_COMPONENTS];
+    for (int i = 0; i < count; i++) {
+        components[i].name = intern(w, entries[i].name);
+        components[i].quantity = entries[i].quantity;
+    }
+    learnFormula(w, potion, components, count);
+    return WITCHER_OK;
+}
+
+// Geralt wins with a known sign or an effective potion in stock; the potion is used up and the
+// monster's trophy added.
+static WitcherResult encounterMonster(WitcherState* w, Slice monster) {
+    int index = findMonster(w, findSym(w, monster));
+    if (index == -1 || !isReady(w, index)) {
+        w->stats.unprepared++;
+        return WITCHER_UNPREPARED;
+    }
+    Sym potion = bestiaryAt(w, index)->effectivePotion;
+    int item = potion ? symAt(w, symKey(w, potion))->item : -1;
+    if (item != -1 && *itemQuantityAt(w, item) > 0)
+        removeItemAt(w, item, 1);
+    addTrophy(w, intern(w, monster), 1);
+    return WITCHER_OK;
+}
+
+// Fills counters with the monster's known potion and sign, sorted by name; returns how many.
+static int effectiveCounters(WitcherState* w, Slice monster, Slice counters[2]) {
+    int index = findMonster(w, findSym(w, monster));
+    if (index == -1)
+        return 0;
+    int count = 0;
+    if (bestiaryAt(w, index)->effectivePotion)
+        counters[count++] = symSlice(w, bestiaryAt(w, index)->effectivePotion);
+    if (bestiaryAt(w, index)->effectiveSign)
+        counters[count++] = symSlice(w, bestiaryAt(w, index)->effectiveSign);
+    if (count == 2 && foldCompare(counters[0].text, counters[1].text) > 0) {
+        Slice temp = counters[0];
+        counters[0] = counters[1];
+        counters[1] = temp;
+    }
+    return count;
+}
+
+// Walks the monsters a potion or sign is effective against, by monster name: start with
+// firstCountered and step with nextCountered until -1. Links are CounterLinks; link / 2 is the entry.
+static CounterLink firstCountered(WitcherState* w, Slice counter) {
+    Sym key = findSym(w, counter);
+    return key ? symAt(w, key)->firstCounter : -1;
+}
+
+static CounterLink nextCountered(WitcherState* w, CounterLink link) {
+    CounterLink next = bestiaryAt(w, link / 2)->nextCounter[link % 2];
+    if (next != -1 && next / 2 == link / 2) // The same name as both potion and sign
+        next = bestiaryAt(w, next / 2)->nextCounter[next % 2];
+    return next;
+}
+
+// Walks the formulas using an ingredient, by potion name, like firstCountered; link / MAX_COMPONENTS
+// is the formula.
+static UseLink firstUseOf(WitcherState* w, Slice ingredient) {
+    Sym key = findSym(w, ingredient);
+    return key ? symAt(w, key)->firstUse : -1;
+}
+
+static UseLink nextUseOf(WitcherState* w, UseLink link) {
+    int formula = link / MAX_COMPONENTS;
+    UseLink next = formulaAt(w, formula)->nextUse[link % MAX_COMPONENTS];
+    while (next != -1 && next / MAX_COMPONENTS == formula) // The ingredient listed twice
+        next = formulaAt(w, formula)->nextUse[next % MAX_COMPONENTS];
+    return next;
+}
+
+// Fills components with the potion's formula in listing order; returns how many, 0 without a formula.
+static int sortedComponents(WitcherState* w, Slice potion, Component components[MAX_COMPONENTS]) {
+    int index = findFormula(w, findSym(w, potion));
+    if (index == -1)
+        return 0;
+    Formula* f = formulaAt(w, index);
+    for (int i = 0; i < f->componentCount; i++)
+        components[i] = f->components[f->listOrder[i]];
+    return f->componentCount;
+}
+
+//Brew Planner//
+// Bulk brews run as a plan over the formula graph: a potion whose stock falls short while brewing is
+// itself brewed from its formula, recursively and a whole shortfall at a time. The plan works on a
+// copy of the quantities involved, so a failed plan changes nothing and a successful one is applied
+// as one net change per item.
+
+// Returns the plan node for the item, adding it on first use.
+static int planNode(WitcherState* w, BrewPlan* plan, Sym name) {
+    Sym key = symKey(w, name);
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->nodes[i].key == key)
+            return i;
+    }
+    if (plan->count == plan->cap) {
+        plan->cap = plan->cap ? plan->cap * 2 : 16;
+        plan->nodes = xrealloc(plan->nodes, plan->cap * sizeof(PlanNode));
+    }
+    PlanNode* node = &plan->nodes[plan->count];
+    node->name = name;
+    node->key = key;
+    node->formula = findFormula(w, name);
+    node->stock = itemQuantity(w, name);
+    node->available = node->stock;
+    node->resolved = 0;
+    node->brewing = 0;
+    return plan->count++;
+}
+
+static void startPlan(BrewPlan* plan) {
+    plan->count = 0;
+    plan->cycle = -1;
+}
+
+// Puts every node back to its stock, keeping the resolved components for the next attempt.
+static void rewindPlan(BrewPlan* plan) {
+    for (int i = 0; i < plan->count; i++) {
+        plan->nodes[i].available = plan->nodes[i].stock;
+        plan->nodes[i].brewing = 0;
+    }
+    plan->cycle = -1;
+}
+
+// Plans brewing count of the node's potion: takes each component from what is available and brews
+// any shortfall first. A formula using its own potion brews it one at a time, so all but the last
+// potion brewed can go back into the next brew. Returns WITCHER_NOT_ENOUGH_INGREDIENTS when an
+// ingredient runs short, the potion itself included, and WITCHER_CYCLIC_FORMULA when a shortfall needs
+// a potion already being brewed further up.
+static WitcherResult planBrew(WitcherState* w, BrewPlan* plan, int node, int count) {
+    if (plan->nodes[node].brewing) {
+        plan->cycle = node;
+        return WITCHER_CYCLIC_FORMULA;
+    }
+    Formula* f = formulaAt(w, plan->nodes[node].formula);
+    if (!plan->nodes[node].resolved) {
+        for (int i = 0; i < f->componentCount; i++) {
+            int component = planNode(w, plan, f->components[i].name);
+            plan->nodes[node].components[i] = component;
+        }
+        plan->nodes[node].resolved = 1;
+    }
+    long long reusable = count - 1; // Potions brewed here that a later brew can still use
+    plan->nodes[node].brewing = 1;
+    for (int i = 0; i < f->componentCount; i++) {
+        int component = plan->nodes[node].components[i];
+        long long need = (long long)count * f->components[i].quantity;
+        if (component == node) {
+            long long reused = need < reusable ? need : reusable;
+            reusable -= reused;
+            need -= reused;
+        }
+        long long shortfall = need - plan->nodes[component].available;
+        if (shortfall > 0) {
+            if (component == node || plan->nodes[component].formula == -1 || need > INT_MAX)
+                return WITCHER_NOT_ENOUGH_INGREDIENTS;
+            WitcherResult result = planBrew(w, plan, component, (int)shortfall);
+            if (result != WITCHER_OK)
+                return result;
+            // Brewing the shortfall can use up some of the component again through a longer chain.
+            if (need > plan->nodes[component].available)
+                return WITCHER_NOT_ENOUGH_INGREDIENTS;
+        }
+        plan->nodes[component].available -= (int)need;
+    }
+    plan->nodes[node].brewing = 0;
+    long long brewed = reusable + 1; // The last potion brewed and any the brews did not use again
+    if (plan->nodes[node].available + brewed > INT_MAX)
+        return WITCHER_NOT_ENOUGH_INGREDIENTS;
+    plan->nodes[node].available += (int)brewed;
+    return WITCHER_OK;
+}
+
+// Applies a finished plan: takes what each item lost, then adds what each gained.
+static void applyPlan(WitcherState* w, const BrewPlan* plan) {
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->nodes[i].available < plan->nodes[i].stock)
+            removeItem(w, plan->nodes[i].name, plan->nodes[i].stock - plan->nodes[i].available);
+    }
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->nodes[i].available > plan->nodes[i].stock)
+            addItem(w, plan->nodes[i].name, plan->nodes[i].available - plan->nodes[i].stock);
+    }
+}
+
+// Brews count of the potion, brewing short sub-potions along the way, or changes nothing. *cycle is
+// set to the potion met again on a cycle for WITCHER_CYCLIC_FORMULA.
+static WitcherResult brewMany(WitcherState* w, Slice potion, int count, Sym* cycle) {
+    if (findFormula(w, findSym(w, potion)) == -1)
+        return WITCHER_NO_FORMULA;
+    BrewPlan* plan = &w->plan;
+    startPlan(plan);
+    WitcherResult result = planBrew(w, plan, planNode(w, plan, intern(w, potion)), count);
+    if (result != WITCHER_OK) {
+        if (result == WITCHER_CYCLIC_FORMULA)
+            *cycle = plan->nodes[plan->cycle].name;
+        w->stats.failedBrews++;
+        return result;
+    }
+    applyPlan(w, plan);
+    return WITCHER_OK;
+}
+
+// Returns how many of the potion a bulk brew could make now, or -1 without a formula. Doubles the
+// count until a plan fails, then bisects; every attempt reuses the components already resolved.
+static int howManyCanBrew(WitcherState* w, Slice potion) {
+    Sym name = findSym(w, potion);
+    int formula = findFormula(w, name);
+    if (formula == -1)
+        return -1;
+    if (formulaAt(w, formula)->componentCount == 0)
+        return 0; // Left by a journal or snapshot from before empty formulas were refused; unbrewable as in the index
+    BrewPlan* plan = &w->plan;
+    startPlan(plan);
+    int target = planNode(w, plan, name);
+    int possible = 0, impossible = 1;
+    for (;;) {
+        rewindPlan(plan);
+        if (planBrew(w, plan, target, impossible) != WITCHER_OK)
+            break;
+        possible = impossible;
+        if (impossible == INT_MAX)
+            return possible;
+        impossible = impossible > INT_MAX / 2 ? INT_MAX : impossible * 2;
+    }
+    while (impossible - possible > 1) {
+        int mid = possible + (impossible - possible) / 2;
+        rewindPlan(plan);
+        if (planBrew(w, plan, target, mid) == WITCHER_OK)
+            possible = mid;
+        else
+            impossible = mid;
+    }
+    return possible;
+}
+
+//Command Lexer//
+
+static void appendEntry(EntryBuffer* buffer, ListEntry entry) {
+    if (buffer->count == buffer->cap) {
+        buffer->cap = buffer->cap ? buffer->cap * 2 : 64;
+        buffer->entries = xrealloc(buffer->entries, buffer->cap * sizeof(ListEntry));
+    }
+    buffer->entries[buffer->count++] = entry;
+}
+
+// Lexes a trimmed "<quantity> <name>" entry the way sscanf("%d %s") did: the name is the first run
+// of non-space characters, or with restIsName everything after the quantity ("%d %[^\n]").
+// Returns 0 unless both parts are present and the quantity is positive.
+static int lexEntry(Slice entry, int restIsName, ListEntry* out) {
+    const char* p = entry.text;
+    const char* end = entry.text + entry.len;
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '+' || *p == '-'))
+        p++;
+    if (p == end || !isdigit((unsigned char)*p))
+        return 0;
+    // Like %d: strtol's saturating conversion, then narrowed to int.
+    unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+    unsigned long magnitude = 0;
+    for (; p < end && isdigit((unsigned char)*p); p++) {
+        unsigned long digit = *p - '0';
+        magnitude = magnitude > (limit - digit) / 10 ? limit : magnitude * 10 + digit;
+    }
+    long value = negative ? (long)(0 - magnitude) : (long)magnitude;
+    while (p < end && isSpaceChar(*p))
+        p++;
+    if (p == end)
+        return 0;
+    const char* nameEnd = end;
+    if (!restIsName) {
+        nameEnd = p;
+        while (nameEnd < end && !isSpaceChar(*nameEnd))
+            nameEnd++;
+    }
+    out->quantity = (int)value;
+    out->name = (Slice){p, (int)(nameEnd - p)};
+    return out->quantity > 0;
+}
+
+// Lexes the comma-separated list in [start, end) into the buffer, stopping after maxEntries entries.
+// The list is trimmed as a whole and empty pieces between commas are skipped, as trim and strtok did.
+// Returns 0 at the first malformed entry, with *count holding the entries lexed before it.
+static int lexList(const char* start, const char* end, int restIsName, int maxEntries, EntryBuffer* buffer,
+                   int* count) {
+    Slice list = trimSlice(start, end);
+    start = list.text;
+    end = list.text + list.len;
+    *count = 0;
+    while (start < end && *count < maxEntries) {
+        const char* comma = memchr(start, ',', end - start);
+        if (!comma)
+            comma = end;
+        if (comma > start) {
+            ListEntry entry;
+            if (!lexEntry(trimSlice(start, comma), restIsName, &entry))
+                return 0;
+            appendEntry(buffer, entry);
+            (*count)++;
+        }
+        if (comma == end)
+            break;
+        start = comma + 1;
+    }
+    return 1;
+}
+
+// Query argument: the text after the keyword, clipped to clipLen characters like the fixed buffer it
+// used to be copied into, cut at the first '?' and trimmed.
+static Slice queryArgument(Slice query, int offset, int clipLen) {
+    Slice rest = clipSlice((Slice){query.text + offset, query.len - offset}, clipLen);
+    const char* qMark = memchr(rest.text, '?', rest.len);
+    return trimSlice(rest.text, qMark ? qMark : rest.text + rest.len);
+}
+
+//Query lexers receive the trimmed line, which ends with '?'.
+
+//"What is effective against <monster> ?"
+static void lexEffectiveQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->kind = WITCHER_QUERY_EFFECTIVE;
+    cmd->name = queryArgument(query, strlen("What is effective against "), MAX_NAME_LEN - 1);
+}
+
+//"Total ingredient <ingredient> ?" or "Total ingredient ?"
+static void lexIngredientQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->kind = WITCHER_QUERY_INGREDIENT;
+    cmd->name = queryArgument(query, strlen("Total ingredient "), MAX_INPUT_LEN - 1);
+}
+
+//"Total potion <potion> ?" or "Total potion ?"
+static void lexPotionQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->kind = WITCHER_QUERY_POTION;
+    cmd->name = queryArgument(query, strlen("Total potion "), MAX_INPUT_LEN - 1);
+}
+
+//"Total trophy <monster> ?" or "Total trophy ?"
+static void lexTrophyQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->kind = WITCHER_QUERY_TROPHY;
+    cmd->name = queryArgument(query, strlen("Total trophy "), MAX_INPUT_LEN - 1);
+}
+
+//"What is in <potion> ?"
+static void lexFormulaQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->kind = WITCHER_QUERY_FORMULA;
+    cmd->name = queryArgument(query, strlen("What is in"), MAX_NAME_LEN - 1);
+}
+
+// Query argument followed by a fixed phrase, as in "How many <potion> can Geralt brew?": the name
+// between the keyword and the phrase, clipped like a name. Empty if the phrase is missing.
+static Slice queryArgumentBefore(Slice query, int offset, const char* phrase) {
+    Slice rest = queryArgument(query, offset, MAX_INPUT_LEN - 1);
+    int nameLen = rest.len - (int)strlen(phrase);
+    if (nameLen < 1 || !foldEqual(rest.text + nameLen, phrase, strlen(phrase)))
+        return (Slice){rest.text, 0};
+    return clipSlice(trimSlice(rest.text, rest.text + nameLen), MAX_NAME_LEN - 1);
+}
+
+//"How many <potion> can Geralt brew?"
+static void lexHowManyQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->name = queryArgumentBefore(query, strlen("How many "), " can Geralt brew");
+    if (cmd->name.len > 0)
+        cmd->kind = WITCHER_QUERY_HOW_MANY;
+}
+
+//"Which monsters is <potion or sign> effective against?"
+static void lexCounteredQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->name = queryArgumentBefore(query, strlen("Which monsters is "), " effective against");
+    if (cmd->name.len > 0)
+        cmd->kind = WITCHER_QUERY_COUNTERED;
+}
+
+//"Which formulas use <ingredient>?"
+static void lexUsesQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    cmd->name = queryArgument(query, strlen("Which formulas use "), MAX_NAME_LEN - 1);
+    if (cmd->name.len > 0)
+        cmd->kind = WITCHER_QUERY_USES;
+}
+
+//"Which monsters can Geralt defeat?"
+static void lexDefeatableQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    if (queryArgument(query, strlen("Which monsters can Geralt defeat"), MAX_INPUT_LEN - 1).len == 0)
+        cmd->kind = WITCHER_QUERY_DEFEATABLE;
+}
+
+//"What can Geralt brew?"
+static void lexBrewableQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    if (queryArgument(query, strlen("What can Geralt brew"), MAX_INPUT_LEN - 1).len == 0)
+        cmd->kind = WITCHER_QUERY_BREWABLE;
+}
+
+//"Stats?"
+static void lexStatsQuery(Slice query, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    if (queryArgument(query, strlen("Stats"), MAX_INPUT_LEN - 1).len == 0)
+        cmd->kind = WITCHER_QUERY_STATS;
+}
+
+//Action lexers receive the whole line.
+
+//Save: "Save <file>"
+static void lexSave(Slice line, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    const char* end = line.text + line.len;
+    if (!startsWith(line.text, end, "Save "))
+        return;
+    cmd->name = trimSlice(line.text + strlen("Save "), end);
+    if (cmd->name.len > 0)
+        cmd->kind = WITCHER_CMD_SAVE;
+}
+
+//Loot: "Geralt loots <ingredient_list>"
+static void lexLoot(Slice line, EntryBuffer* buffer, Command* cmd) {
+    const char* end = line.text + line.len;
+    const char* list = findText(line.text, end, "Geralt loots ");
+    if (!list)
+        return;
+    // Entries before a malformed one are still looted, as they always were.
+    cmd->kind = WITCHER_CMD_LOOT;
+    cmd->firstItem = buffer->count;
+    if (!lexList(list + strlen("Geralt loots "), end, 0, INT_MAX, buffer, &cmd->itemCount))
+        cmd->listError = 1;
+}
+
+//Trade: "Geralt trades <trophy_list> for <ingredient_list>"
+static void lexTrade(Slice line, EntryBuffer* buffer, Command* cmd) {
+    const char* end = line.text + line.len;
+    if (!startsWith(line.text, end, "Geralt trades "))
+        return;
+    const char* tradeLine = line.text + strlen("Geralt trades ");
+    const char* forKeyword = findText(tradeLine, end, "for");
+    if (!forKeyword)
+        return;
+    // A malformed entry is only reported once the trophies before it have been checked.
+    cmd->kind = WITCHER_CMD_TRADE;
+    cmd->firstTrophy = buffer->count;
+    if (!lexList(tradeLine, forKeyword, 1, INT_MAX, buffer, &cmd->trophyCount)) {
+        cmd->listError = 1;
+        return;
+    }
+    cmd->firstItem = buffer->count;
+    if (!lexList(forKeyword + 3, end, 0, INT_MAX, buffer, &cmd->itemCount))
+        cmd->listError = 1;
+}
+
+//Brew: "Geralt brews <potion>"
+static void lexBrew(Slice line, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    const char* end = line.text + line.len;
+    if (!startsWith(line.text, end, "Geralt brews "))
+        return;
+    cmd->kind = WITCHER_CMD_BREW;
+    cmd->name = trimSlice(line.text + strlen("Geralt brews "), end);
+    // "Geralt brews <count> <potion>" is a bulk brew
+    ListEntry bulk;
+    if (lexEntry(cmd->name, 1, &bulk)) {
+        cmd->kind = WITCHER_CMD_BULK_BREW;
+        cmd->name = bulk.name;
+        cmd->quantity = bulk.quantity;
+    }
+}
+
+//Encounter: "Geralt encounters a <monster>"
+static void lexEncounter(Slice line, EntryBuffer* buffer, Command* cmd) {
+    (void)buffer;
+    const char* end = line.text + line.len;
+    if (!startsWith(line.text, end, "Geralt encounters a "))
+        return;
+    cmd->kind = WITCHER_CMD_ENCOUNTER;
+    cmd->name = trimSlice(line.text + strlen("Geralt encounters a "), end);
+}
+
+//Learn: "Geralt learns <counter> <sign|potion> is effective against <monster>"
+//    or "Geralt learns <potion> potion consists of <ingredient_list>"
+static void lexLearn(Slice line, EntryBuffer* buffer, Command* cmd) {
+    const char* end = line.text + line.len;
+    if (!startsWith(line.text, end, "Geralt learns "))
+        return;
+    Slice learnPart = trimSlice(line.text + strlen("Geralt learns "), end);
+    const char* partEnd = learnPart.text + learnPart.len;
+    const char* effective = findText(learnPart.text, partEnd, "is effective against");
+    if (effective) {
+        // The first two words before the phrase are the counter and its type.
+        Slice words[2];
+        const char* p = learnPart.text;
+        for (int w = 0; w < 2; w++) {
+            while (p < effective && isSpaceChar(*p))
+                p++;
+            if (p == effective)
+                return;
+            const char* wordStart = p;
+            while (p < effective && !isSpaceChar(*p))
+                p++;
+            words[w] = (Slice){wordStart, (int)(p - wordStart)};
+        }
+        if (words[1].len == 4 && foldEqualScalar(words[1].text, "sign", 4))
+            cmd->counterIsSign = 1;
+        else if (words[1].len != 6 || !foldEqualScalar(words[1].text, "potion", 6))
+            return;
+        cmd->kind = WITCHER_CMD_LEARN_EFFECTIVE;
+        cmd->counter = words[0];
+        cmd->name = clipSlice(trimSlice(effective + strlen("is effective against"), partEnd), MAX_NAME_LEN - 1);
+        return;
+    }
+    const char* consists = findText(learnPart.text, partEnd, "consists of");
+    if (!consists)
+        return;
+    const char* potion = findText(learnPart.text, partEnd, "potion");
+    if (!potion)
+        return;
+    if (potion - learnPart.text >= MAX_NAME_LEN)
+        potion = learnPart.text + MAX_NAME_LEN - 1;
+    cmd->name = trimSlice(learnPart.text, potion);
+    cmd->firstItem = buffer->count;
+    if (lexList(consists + strlen("consists of"), partEnd, 0, MAX_COMPONENTS, buffer, &cmd->itemCount) &&
+        cmd->itemCount > 0) // A formula needs a component, as witcherLearnFormula insists too
+        cmd->kind = WITCHER_CMD_LEARN_FORMULA;
+}
+
+//Statistics//
+
+static void recordLatency(Stats* stats, CommandKind kind, long long ns) {
+    int bucket = ns > 0 ? 64 - __builtin_clzll((unsigned long long)ns) : 0;
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+    stats->latency[kind][bucket]++;
+}
+
+// Upper bound in ns of the bucket that holds the given fraction of a kind's timed commands.
+static long long latencyPercentile(const Stats* stats, CommandKind kind, double fraction) {
+    long long total = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+        total += stats->latency[kind][b];
+    long long seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += stats->latency[kind][b];
+        if (seen > 0 && seen >= fraction * total)
+            return 1LL << b;
+    }
+    return 0;
+}
+
+// Counts a command, a text line or a typed call, before it runs; returns its start time if timing is on.
+static long long startCommand(WitcherState* w, CommandKind kind) {
+    w->stats.commands++;
+    w->stats.byKind[kind]++;
+    return w->stats.timing ? monotonicNs() : 0;
+}
+
+// Times a command that has run and gives the journal its chance at a group commit.
+static void finishCommand(WitcherState* w, CommandKind kind, long long start) {
+    if (w->stats.timing)
+        recordLatency(&w->stats, kind, monotonicNs() - start);
+    journalTick(&w->journal);
+}
+
+// Formulas and bestiary entries are never removed, so their peaks are the current counts.
+static void formatStats(WitcherState* w, WitcherOutput* out) {
+    Stats* stats = &w->stats;
+    outPrintf(out, "Commands: %lld, INVALID: %lld\n", stats->commands, stats->invalid);
+    outPrintf(out, "Failed brews: %lld, failed trades: %lld, unprepared encounters: %lld\n", stats->failedBrews,
+              stats->failedTrades, stats->unprepared);
+    outPrintf(out, "Query cache: %lld hits, %lld misses\n", stats->cacheHits, stats->cacheMisses);
+    outPrintf(out, "Peak occupancy: %d inventory items, %d trophies, %d formulas, %d bestiary entries\n",
+              stats->peakItems, stats->peakTrophies, w->formulaBook.count, w->bestiary.count);
+    for (int k = 0; k < WITCHER_COMMAND_KINDS; k++) {
+        if (stats->byKind[k] == 0)
+            continue;
+        outPrintf(out, "%s: %lld", commandKindNames[k], stats->byKind[k]);
+        if (stats->timing && k != WITCHER_CMD_EXIT)
+            outPrintf(out, ", p50 < %lld ns, p99 < %lld ns", latencyPercentile(stats, k, 0.50),
+                      latencyPercentile(stats, k, 0.99));
+        outPrintf(out, "\n");
+    }
+}
+
+//Snapshots//
+
+// Tables saved in a snapshot, indexed by SnapshotSectionId; every table of a state is one of them.
+static const size_t snapshotTables[] = {
+    offsetof(WitcherState, symbols), offsetof(WitcherState, itemNames), offsetof(WitcherState, itemQuantities),
+    offsetof(WitcherState, itemCategories), offsetof(WitcherState, itemSortKeys), offsetof(WitcherState, freeItems),
+    offsetof(WitcherState, trophyMonsters), offsetof(WitcherState, trophyQuantities),
+    offsetof(WitcherState, trophySortKeys), offsetof(WitcherState, freeTrophies), offsetof(WitcherState, formulaBook),
+    offsetof(WitcherState, bestiary), offsetof(WitcherState, readyWords)
+};
+
+#define SNAPSHOT_TABLE_COUNT (int)(sizeof(snapshotTables) / sizeof(snapshotTables[0]))
+
+// Sorted views saved as slot order, starting at SNAP_INGREDIENT_ORDER.
+static const size_t snapshotViews[] = {
+    offsetof(WitcherState, itemViews[ITEM_INGREDIENT]), offsetof(WitcherState, itemViews[ITEM_POTION]),
+    offsetof(WitcherState, trophyView), offsetof(WitcherState, brewableView)
+};
+
+#define SNAPSHOT_VIEW_COUNT (int)(sizeof(snapshotViews) / sizeof(snapshotViews[0]))
+
+static Table* snapshotTable(WitcherState* w, int t) {
+    return (Table*)((char*)w + snapshotTables[t]);
+}
+
+static SortedView* snapshotView(WitcherState* w, int v) {
+    return (SortedView*)((char*)w + snapshotViews[v]);
+}
+
+static size_t align64(size_t size) {
+    return (size + 63) & ~(size_t)63;
+}
+
+// Bytes one table chunk takes in a snapshot; chunks start 16-byte aligned like arena allocations.
+static size_t snapshotChunkBytes(const Table* table) {
+    return (TABLE_CHUNK * table->recordSize + 15) & ~(size_t)15;
+}
+
+static size_t snapshotTableBytes(const Table* table) {
+    return (size_t)((table->count + TABLE_CHUNK - 1) / TABLE_CHUNK) * snapshotChunkBytes(table);
+}
+
+// Syncs the directory holding path, so a rename into it survives a crash. Returns 0 with errno set on
+// failure.
+static int syncParentDir(const char* path) {
+    const char* slash = strrchr(path, '/');
+    size_t len = slash ? (slash == path ? 1 : (size_t)(slash - path)) : 1;
+    char dir[len + 1];
+    memcpy(dir, slash ? path : ".", len);
+    dir[len] = '\0';
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    int ok = fsync(fd) == 0;
+    int error = errno;
+    close(fd);
+    errno = error;
+    return ok;
+}
+
+// Writes inventory, trophies, formula book, bestiary and the symbols they name to path. Tables are
+// written as whole chunks so a load can use them where they lie in the mapped file. The file is
+// written and synced under a temporary name, renamed into place and the directory synced, so a crash
+// leaves either the old snapshot or the whole new one. Returns 0 with errno set on failure.
+static int saveSnapshot(WitcherState* w, const char* path) {
+    SnapshotSection sections[SNAP_SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    size_t size = align64(sizeof(SnapshotHeader) + sizeof(sections));
+    for (int t = 0; t < SNAPSHOT_TABLE_COUNT; t++) {
+        sections[t].offset = size;
+        sections[t].count = snapshotTable(w, t)->count;
+        sections[t].recordSize = snapshotTable(w, t)->recordSize;
+        size = align64(size + snapshotTableBytes(snapshotTable(w, t)));
+    }
+    sections[SNAP_SYMBOL_INDEX].offset = size;
+    sections[SNAP_SYMBOL_INDEX].count = w->symbolIndexCap;
+    sections[SNAP_SYMBOL_INDEX].recordSize = sizeof(IndexSlot);
+    sections[SNAP_SYMBOL_INDEX].extra = w->symbolIndexCount;
+    size = align64(size + w->symbolIndexCap * sizeof(IndexSlot));
+    for (int v = 0; v < SNAPSHOT_VIEW_COUNT; v++) {
+        sections[SNAP_INGREDIENT_ORDER + v].offset = size;
+        sections[SNAP_INGREDIENT_ORDER + v].count = snapshotView(w, v)->count;
+        sections[SNAP_INGREDIENT_ORDER + v].recordSize = sizeof(int);
+        size = align64(size + snapshotView(w, v)->count * sizeof(int));
+    }
+
+    char* image = calloc(1, size);
+    if (!image)
+        return 0;
+    for (int t = 0; t < SNAPSHOT_TABLE_COUNT; t++) {
+        Table* table = snapshotTable(w, t);
+        for (int c = 0; c * TABLE_CHUNK < table->count; c++)
+            memcpy(image + sections[t].offset + c * snapshotChunkBytes(table), table->chunks[c],
+                   TABLE_CHUNK * table->recordSize);
+    }
+    if (w->symbolIndexCap > 0)
+        memcpy(image + sections[SNAP_SYMBOL_INDEX].offset, w->symbolIndex, w->symbolIndexCap * sizeof(IndexSlot));
+    for (int v = 0; v < SNAPSHOT_VIEW_COUNT; v++) {
+        int* order = (int*)(image + sections[SNAP_INGREDIENT_ORDER + v].offset);
+        int i = 0;
+        for (ViewNode* node = viewFirst(snapshotView(w, v)); node; node = node->next[0])
+            order[i++] = node->item;
+    }
+    memcpy(image + sizeof(SnapshotHeader), sections, sizeof(sections));
+    SnapshotHeader header = {"WITCHSNP", SNAPSHOT_VERSION, 0x01020304u, size, journalCampaign(&w->journal),
+                             w->journal.seq, 0};
+    header.checksum = blockChecksum(image + sizeof(header), size - sizeof(header));
+    memcpy(image, &header, sizeof(header));
+
+    char tempPath[strlen(path) + 5];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE* out = fopen(tempPath, "wb");
+    int ok = out && fwrite(image, 1, size, out) == size && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    if (out && fclose(out) != 0)
+        ok = 0;
+    if (ok && (rename(tempPath, path) != 0 || !syncParentDir(path)))
+        ok = 0;
+    if (!ok && out)
+        remove(tempPath);
+    free(image);
+    return ok;
+}
+
+// Points a table at its chunks inside a mapped snapshot.
+static void mapTable(Table* table, char* base, const SnapshotSection* section) {
+    int chunkCount = (int)((section->count + TABLE_CHUNK - 1) / TABLE_CHUNK);
+    table->chunkCap = chunkCount > 8 ? chunkCount : 8;
+    table->chunks = xrealloc(table->chunks, table->chunkCap * sizeof(char*));
+    for (int c = 0; c < chunkCount; c++)
+        table->chunks[c] = base + section->offset + c * snapshotChunkBytes(table);
+    table->chunkCount = chunkCount;
+    table->count = (int)section->count;
+}
+
+// Replaces the empty state with a snapshot written by saveSnapshot. The file is mapped copy-on-write
+// and its records are used in place: there is no per-record parsing, only the symbol index is copied
+// and the sorted views are linked on first use. The checksum guards against damaged files, not
+// crafted ones. Returns NULL on success, otherwise what is wrong with the file.
+static const char* loadSnapshot(WitcherState* w, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return strerror(errno);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return strerror(errno);
+    }
+    size_t size = st.st_size;
+    SnapshotSection sections[SNAP_SECTION_COUNT];
+    if (size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return "not a snapshot";
+    }
+    char* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return strerror(errno);
+
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    const char* error = NULL;
+    if (memcmp(header.magic, "WITCHSNP", 8) != 0)
+        error = "not a snapshot";
+    else if (header.version != SNAPSHOT_VERSION || header.byteOrder != 0x01020304u)
+        error = "snapshot from an incompatible version";
+    else if (header.size != size || size % 64 != 0 || size < align64(sizeof(header) + sizeof(sections)))
+        error = "truncated snapshot";
+    else if (header.checksum != blockChecksum(base + sizeof(header), size - sizeof(header)))
+        error = "checksum mismatch";
+    if (!error)
+        memcpy(sections, base + sizeof(header), sizeof(sections));
+    for (int s = 0; s < SNAP_SECTION_COUNT && !error; s++) {
+        size_t recordSize = s < SNAPSHOT_TABLE_COUNT ? snapshotTable(w, s)->recordSize
+                          : s == SNAP_SYMBOL_INDEX   ? sizeof(IndexSlot)
+                                                     : sizeof(int);
+        size_t bytes = s < SNAPSHOT_TABLE_COUNT
+            ? (size_t)((sections[s].count + TABLE_CHUNK - 1) / TABLE_CHUNK) * snapshotChunkBytes(snapshotTable(w, s))
+            : sections[s].count * recordSize;
+        if (sections[s].recordSize != recordSize)
+            error = "snapshot from an incompatible version";
+        else if (sections[s].count > INT_MAX || sections[s].offset % 64 != 0 || sections[s].offset > size ||
+                 bytes > size - sections[s].offset)
+            error = "damaged snapshot";
+    }
+    int indexCap = (int)sections[SNAP_SYMBOL_INDEX].count;
+    if (!error && (indexCap & (indexCap - 1)) != 0)
+        error = "damaged snapshot";
+    if (error) {
+        munmap(base, size);
+        return error;
+    }
+
+    for (int t = 0; t < SNAPSHOT_TABLE_COUNT; t++)
+        mapTable(snapshotTable(w, t), base, &sections[t]);
+    free(w->symbolIndex);
+    w->symbolIndex = NULL;
+    if (indexCap > 0) {
+        w->symbolIndex = xrealloc(NULL, indexCap * sizeof(IndexSlot));
+        memcpy(w->symbolIndex, base + sections[SNAP_SYMBOL_INDEX].offset, indexCap * sizeof(IndexSlot));
+    }
+    w->symbolIndexCap = indexCap;
+    w->symbolIndexCount = sections[SNAP_SYMBOL_INDEX].extra;
+    for (int v = 0; v < SNAPSHOT_VIEW_COUNT; v++) {
+        snapshotView(w, v)->head = NULL;
+        snapshotView(w, v)->count = (int)sections[SNAP_INGREDIENT_ORDER + v].count;
+        snapshotView(w, v)->pending = (const int*)(base + sections[SNAP_INGREDIENT_ORDER + v].offset);
+    }
+    w->stats.peakItems = w->itemNames.count - w->freeItems.count;
+    w->stats.peakTrophies = w->trophyMonsters.count - w->freeTrophies.count;
+    w->journal.campaign = header.campaign;
+    w->journal.seq = header.journalSeq;
+    for (int d = 0; d < DATA_SET_COUNT; d++)
+        w->versions[d]++;
+    w->snapshot = base;
+    w->snapshotSize = size;
+    return NULL;
+}
+
+//Journal Recovery//
+
+static int readJournalName(const char** p, const char* end, Slice* name) {
+    if (*p >= end || end - *p - 1 < (unsigned char)**p)
+        return 0;
+    *name = (Slice){*p + 1, (unsigned char)**p};
+    *p += 1 + name->len;
+    return 1;
+}
+
+static int readJournalInt(const char** p, const char* end, int* value) {
+    if (end - *p < (ptrdiff_t)sizeof(int))
+        return 0;
+    memcpy(value, *p, sizeof(int));
+    *p += sizeof(int);
+    return 1;
+}
+
+// Re-applies one journal record, or only steps over it when apply is 0. Returns 0 if the record is
+// malformed.
+static int replayRecord(WitcherState* w, const char** p, const char* end, int apply) {
+    if (*p >= end)
+        return 0;
+    JournalOp op = (unsigned char)*(*p)++;
+    Slice name, counter;
+    int quantity;
+    switch (op) {
+    case JOURNAL_ADD_ITEM:
+    case JOURNAL_REMOVE_ITEM:
+    case JOURNAL_ADD_TROPHY:
+    case JOURNAL_REMOVE_TROPHY:
+        if (!readJournalName(p, end, &name) || !readJournalInt(p, end, &quantity))
+            return 0;
+        if (!apply)
+            return 1;
+        if (op == JOURNAL_ADD_ITEM)
+            addItem(w, intern(w, name), quantity);
+        else if (op == JOURNAL_REMOVE_ITEM)
+            removeItem(w, findSym(w, name), quantity);
+        else if (op == JOURNAL_ADD_TROPHY)
+            addTrophy(w, intern(w, name), quantity);
+        else
+            removeTrophy(w, findSym(w, name), quantity);
+        return 1;
+    case JOURNAL_LEARN_EFFECTIVE: {
+        if (!readJournalName(p, end, &name) || !readJournalName(p, end, &counter) || *p >= end)
+            return 0;
+        int isSign = *(*p)++;
+        if (apply)
+            learnEffectiveness(w, intern(w, name), intern(w, counter), isSign);
+        return 1;
+    }
+    case JOURNAL_LEARN_FORMULA: {
+        if (!readJournalName(p, end, &name) || *p >= end)
+            return 0;
+        int count = (unsigned char)*(*p)++;
+        if (count > MAX_COMPONENTS)
+            return 0;
+        Slice componentNames[MAX_COMPONENTS];
+        Component components[MAX_COMPONENTS];
+        for (int i = 0; i < count; i++) {
+            if (!readJournalName(p, end, &componentNames[i]) || !readJournalInt(p, end, &components[i].quantity))
+                return 0;
+        }
+        if (apply) {
+            Sym potion = intern(w, name);
+            for (int i = 0; i < count; i++)
+                components[i].name = intern(w, componentNames[i]);
+            learnFormula(w, potion, components, count);
+        }
+        return 1;
+    }
+    default:
+        return 0;
+    }
+}
+
+// Opens the journal at path, creating it if needed. Records past the current state (empty, or a
+// loaded snapshot, which must come from the same campaign) are replayed first; a torn frame left by
+// a crash and anything after it is cut off. New records are appended from there. Returns NULL on
+// success, otherwise what is wrong.
+static const char* openJournal(WitcherState* w, const char* path) {
+    Journal* journal = &w->journal;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return strerror(errno);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return strerror(errno);
+    }
+    size_t size = st.st_size;
+    size_t good = 0; // Bytes of intact frames
+    const char* error = NULL;
+    if (size > 0) {
+        char* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return strerror(errno);
+        }
+        journal->replaying = 1;
+        while (!error && size - good >= sizeof(JournalFrame)) {
+            JournalFrame frame;
+            memcpy(&frame, base + good, sizeof(frame));
+            if (frame.magic != JOURNAL_MAGIC || frame.bytes % 8 != 0 || frame.bytes > size - good - sizeof(frame) ||
+                frame.checksum != blockChecksum(base + good + 8, sizeof(frame) - 8 + frame.bytes))
+                break;
+            if (journal->campaign == 0 && journal->seq == 0)
+                journal->campaign = frame.campaign; // Starting empty: take over the journal's campaign
+            if (frame.campaign != journal->campaign) {
+                error = "journal belongs to a different campaign";
+                break;
+            }
+            const char* p = base + good + sizeof(frame);
+            const char* end = p + frame.bytes;
+            for (uint32_t r = 0; r < frame.records && !error; r++) {
+                uint64_t seq = frame.firstSeq + r;
+                if (seq > journal->seq + 1)
+                    error = "journal does not continue the loaded state";
+                else if (!replayRecord(w, &p, end, seq == journal->seq + 1))
+                    error = "damaged journal";
+                else if (seq > journal->seq)
+                    error = "journal does not match the loaded state";
+            }
+            good += sizeof(frame) + frame.bytes;
+        }
+        journal->replaying = 0;
+        munmap(base, size);
+    }
+    if (!error && good < size) {
+        fprintf(stderr, "Journal %s: discarding %zu bytes of an incomplete commit\n", path, size - good);
+        if (ftruncate(fd, good) != 0)
+            error = strerror(errno);
+    }
+    if (!error && lseek(fd, good, SEEK_SET) < 0)
+        error = strerror(errno);
+    if (error) {
+        close(fd);
+        return error;
+    }
+    journal->fd = fd;
+    return NULL;
+}
+
+//Query Functions//
+
+// Appends a sorted view of inventory items as "<quantity> <name>, ...", or "None" when it is empty.
+static void printItemView(WitcherState* w, SortedView* view, WitcherOutput* out) {
+    if (view->count == 0) {
+        outPrintf(out, "None\n");
+        return;
+    }
+    for (ViewNode* node = viewFirst(view); node; node = node->next[0])
+        outPrintf(out, node->next[0] ? "%d %s, " : "%d %s\n", *itemQuantityAt(w, node->item),
+                  symName(w, *itemNameAt(w, node->item)));
+}
+
+//Potion/Sign Effectiveness Query: "What is effective against <monster> ?"
+static int processEffectiveQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    Slice monster = cmd->name;
+    Slice counters[2];
+    int count = effectiveCounters(w, monster, counters); // Look up the monster's effective counter(s) in the bestiary.
+    if (count == 0) {
+        outPrintf(out, "No knowledge of %.*s\n", monster.len, monster.text);
+        return 1;
+    }
+    outPrintf(out, "%s", counters[0].text);
+    for (int i = 1; i < count; i++) {
+        outPrintf(out, ", %s", counters[i].text);
+    }
+    outPrintf(out, "\n");
+    return 1;
+}
+
+//Specific Ingredient Query: "Total ingredient <ingredient> ?"
+static int processIngredientQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (cmd->name.len > 0)
+        outPrintf(out, "%d\n", itemQuantity(w, findSym(w, cmd->name)));
+    else
+        printItemView(w, &w->itemViews[ITEM_INGREDIENT], out); //List all ingredients sorted by name (not potions and not trophies)
+    return 1;
+}
+
+//Specific Potion Query: "Total potion <potion> ?"
+static int processPotionQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (cmd->name.len > 0)
+        outPrintf(out, "%d\n", itemQuantity(w, findSym(w, cmd->name)));
+    else
+        printItemView(w, &w->itemViews[ITEM_POTION], out); //List all potions sorted by name.
+    return 1;
+}
+
+//Specific Trophy Query: "Total trophy <monster> ?"
+static int processTrophyQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (cmd->name.len > 0) {
+        outPrintf(out, "%d\n", trophyQuantity(w, findSym(w, cmd->name)));
+        return 1;
+    }
+    //List all trophies sorted by monster names.
+    if (w->trophyView.count == 0) {
+        outPrintf(out, "None\n");
+        return 1;
+    }
+    for (ViewNode* node = viewFirst(&w->trophyView); node; node = node->next[0])
+        outPrintf(out, node->next[0] ? "%d %s, " : "%d %s\n", *trophyQuantityAt(w, node->item),
+                  symName(w, *trophyMonsterAt(w, node->item)));
+    return 1;
+}
+
+//Potion Formula Query: "What is in <potion> ?"
+static int processFormulaQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    Slice potion = cmd->name;
+    Component components[MAX_COMPONENTS];
+    int compCount = sortedComponents(w, potion, components);
+    if (compCount == 0) {
+        outPrintf(out, "No formula for %.*s\n", potion.len, potion.text);
+        return 1;
+    }
+    for (int i = 0; i < compCount; i++) {
+        outPrintf(out, i < compCount - 1 ? "%d %s, " : "%d %s\n", components[i].quantity,
+                  symName(w, components[i].name));
+    }
+    return 1;
+}
+
+//Bulk Brew Query: "How many <potion> can Geralt brew?"
+static int processHowManyQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    int count = howManyCanBrew(w, cmd->name);
+    if (count == -1)
+        outPrintf(out, "No formula for %.*s\n", cmd->name.len, cmd->name.text);
+    else
+        outPrintf(out, "%d\n", count);
+    return 1;
+}
+
+//Counter Query: "Which monsters is <potion or sign> effective against?"
+static int processCounteredQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    CounterLink link = firstCountered(w, cmd->name);
+    if (link == -1)
+        outPrintf(out, "None\n");
+    for (; link != -1; link = nextCountered(w, link)) {
+        CounterLink next = nextCountered(w, link);
+        outPrintf(out, next != -1 ? "%s, " : "%s\n", symName(w, bestiaryAt(w, link / 2)->monsterName));
+    }
+    return 1;
+}
+
+//Ingredient Use Query: "Which formulas use <ingredient>?"
+static int processUsesQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    UseLink link = firstUseOf(w, cmd->name);
+    if (link == -1)
+        outPrintf(out, "None\n");
+    for (; link != -1; link = nextUseOf(w, link)) {
+        UseLink next = nextUseOf(w, link);
+        outPrintf(out, next != -1 ? "%s, " : "%s\n", symName(w, formulaAt(w, link / MAX_COMPONENTS)->potionName));
+    }
+    return 1;
+}
+
+//Readiness Query: "Which monsters can Geralt defeat?"
+static int processDefeatableQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    (void)cmd;
+    int count;
+    int* entries = readyMonsters(w, &count);
+    if (count == 0)
+        outPrintf(out, "None\n");
+    for (int i = 0; i < count; i++)
+        outPrintf(out, i < count - 1 ? "%s, " : "%s\n", symName(w, bestiaryAt(w, entries[i])->monsterName));
+    free(entries);
+    return 1;
+}
+
+//Brewable Potions Query: "What can Geralt brew?"
+static int processBrewableQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    (void)cmd;
+    if (w->brewableView.count == 0) {
+        outPrintf(out, "None\n");
+        return 1;
+    }
+    for (ViewNode* node = viewFirst(&w->brewableView); node; node = node->next[0]) {
+        Formula* f = formulaAt(w, node->item);
+        outPrintf(out, node->next[0] ? "%d %s, " : "%d %s\n", f->brewable, symName(w, f->potionName));
+    }
+    return 1;
+}
+
+//Statistics Query: "Stats?"
+static int processStatsQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    (void)cmd;
+    formatStats(w, out);
+    return 1;
+}
+
+//Query Cache//
+
+// FNV-1a over the command kind and the exact bytes of the name, since answers can echo the name.
+static unsigned int queryHash(const Command* cmd) {
+    unsigned int hash = (2166136261u ^ cmd->kind) * 16777619u;
+    for (int i = 0; i < cmd->name.len; i++) {
+        hash ^= (unsigned char)cmd->name.text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Sum of the versions of the given sets; versions only grow, so the sum changes whenever one does.
+static unsigned long long dataStamp(WitcherState* w, unsigned int reads) {
+    unsigned long long stamp = 0;
+    for (int d = 0; d < DATA_SET_COUNT; d++) {
+        if (reads & 1u << d)
+            stamp += w->versions[d];
+    }
+    return stamp;
+}
+
+// Runs a query whose command declares what it reads, answering from the cache when nothing it reads
+// has changed since the same query was last answered. Misses run the handler and keep its response.
+static int runCachedQuery(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (!w->queryCache) {
+        w->queryCache = xrealloc(NULL, QUERY_CACHE_SLOTS * sizeof(QueryCacheEntry));
+        memset(w->queryCache, 0, QUERY_CACHE_SLOTS * sizeof(QueryCacheEntry));
+    }
+    unsigned int hash = queryHash(cmd);
+    unsigned long long stamp = dataStamp(w, cmd->spec->reads);
+    QueryCacheEntry* entry = &w->queryCache[hash & (QUERY_CACHE_SLOTS - 1)];
+    if (entry->spec == cmd->spec && entry->hash == hash && entry->stamp == stamp && entry->keyLen == cmd->name.len &&
+        (cmd->name.len == 0 || memcmp(entry->text, cmd->name.text, cmd->name.len) == 0)) {
+        outPrintf(out, "%.*s", (int)(entry->len - entry->keyLen), entry->text + entry->keyLen);
+        w->stats.cacheHits++;
+        return 1;
+    }
+    size_t mark = out->len;
+    if (!cmd->spec->handle(w, cmd, out))
+        return 0;
+    size_t len = cmd->name.len + (out->len - mark);
+    if (len > entry->cap) {
+        entry->text = xrealloc(entry->text, len);
+        entry->cap = len;
+    }
+    if (cmd->name.len > 0)
+        memcpy(entry->text, cmd->name.text, cmd->name.len);
+    memcpy(entry->text + cmd->name.len, out->text + mark, out->len - mark);
+    entry->spec = cmd->spec;
+    entry->hash = hash;
+    entry->stamp = stamp;
+    entry->keyLen = cmd->name.len;
+    entry->len = len;
+    w->stats.cacheMisses++;
+    return 1;
+}
+
+//Action Handlers//
+
+//Loot Action: "Geralt loots" followed by an ingredient_list.
+static int processLoot(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    lootEntries(w, cmd->list->entries + cmd->firstItem, cmd->itemCount);
+    if (cmd->listError)
+        return 0;
+    outPrintf(out, "Alchemy ingredients obtained\n");
+    return 1;
+}
+
+//Trade Action: "Geralt trades" followed by a trophy_list, "for", then an ingredient_list.
+static int processTrade(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    // processTrade: Validates the available trophy quantities, then swaps the trophies for the ingredients.
+    const ListEntry* trophyList = cmd->list->entries + cmd->firstTrophy;
+    if (!haveTrophies(w, trophyList, cmd->trophyCount)) {
+        outPrintf(out, "Not enough trophies\n");
+        return 1;
+    }
+    lootEntries(w, cmd->list->entries + cmd->firstItem, cmd->itemCount);
+    if (cmd->listError)
+        return 0;
+    giveTrophies(w, trophyList, cmd->trophyCount);
+    outPrintf(out, "Trade successful\n");
+    return 1;
+}
+
+//Brew Action: "Geralt brews" followed by a potion.
+static int processBrew(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    Slice potion = cmd->name;
+    Sym cycle = 0;
+    WitcherResult result = cmd->kind == WITCHER_CMD_BULK_BREW ? brewMany(w, potion, cmd->quantity, &cycle)
+                                                              : brewPotion(w, potion);
+    switch (result) {
+    case WITCHER_NO_FORMULA:
+        outPrintf(out, "No formula for %.*s\n", potion.len, potion.text);
+        break;
+    case WITCHER_NOT_ENOUGH_INGREDIENTS:
+        outPrintf(out, "Not enough ingredients\n");
+        break;
+    case WITCHER_CYCLIC_FORMULA:
+        outPrintf(out, "Cyclic formula for %s\n", symName(w, cycle));
+        break;
+    default:
+        if (cmd->kind == WITCHER_CMD_BULK_BREW)
+            outPrintf(out, "Alchemy items created: %d %.*s\n", cmd->quantity, potion.len, potion.text);
+        else
+            outPrintf(out, "Alchemy item created: %.*s\n", potion.len, potion.text);
+        break;
+    }
+    return 1;
+}
+
+//Learn Action: Handles both effectiveness and potion formula learning.
+static int processLearn(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+// processLearn: Handles learning commands for both combat effectiveness and potion formulas.
+// Effectiveness updates or adds a bestiary entry; a formula is added to the formula book if it
+// isn't known already.
+
+    if (cmd->kind == WITCHER_CMD_LEARN_EFFECTIVE) {
+        Slice enemy = cmd->name;
+        switch (learnCounter(w, cmd->counter, cmd->counterIsSign, enemy)) {
+        case WITCHER_NEW_ENTRY:
+            outPrintf(out, "New bestiary entry added: %.*s\n", enemy.len, enemy.text);
+            break;
+        case WITCHER_ALREADY_KNOWN:
+            outPrintf(out, "Already known effectiveness\n");
+            break;
+        default:
+            outPrintf(out, "Bestiary entry updated: %.*s\n", enemy.len, enemy.text);
+            break;
+        }
+        return 1;
+    }
+    // New potion formula
+    Slice potionName = cmd->name;
+    if (learnPotionFormula(w, potionName, cmd->list->entries + cmd->firstItem, cmd->itemCount) ==
+        WITCHER_ALREADY_KNOWN) {
+        outPrintf(out, "Already known formula\n");
+        return 1;
+    }
+    outPrintf(out, "New alchemy formula obtained: %.*s\n", potionName.len, potionName.text);
+    return 1;
+}
+
+//Save Action: "Save <file>" writes a snapshot that --load <file> starts from.
+static int processSave(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (w->noFileCommands)
+        return 0;
+    char path[cmd->name.len + 1];
+    memcpy(path, cmd->name.text, cmd->name.len);
+    path[cmd->name.len] = '\0';
+    journalCommit(&w->journal); // The journal never lags a snapshot
+    if (!saveSnapshot(w, path)) {
+        outPrintf(out, "Cannot save %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    outPrintf(out, "State saved to %s\n", path);
+    return 1;
+}
+
+//Encounter Action: "Geralt encounters a <monster>"
+static int processEncounter(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+// processEncounter: Simulates a monster encounter.
+// Checks whether Geralt has an effective counter (either a sign or an available potion) for the enemy.
+// If successful, consumes the potion (if applicable) and awards a trophy; otherwise, signals that Geralt is unprepared.
+
+    Slice monster = cmd->name;
+    if (encounterMonster(w, monster) == WITCHER_UNPREPARED)
+        outPrintf(out, "Geralt is unprepared and barely escapes with his life\n");
+    else
+        outPrintf(out, "Geralt defeats %.*s\n", monster.len, monster.text);
+    return 1;
+}
+
+//Command Dispatch//
+
+// Folds a keyword or input byte the way the trie stores it.
+static unsigned char trieByte(const KeywordTrie* trie, char c) {
+    return trie->foldCase ? foldByte(c) : (unsigned char)c;
+}
+
+static int trieNode(KeywordTrie* trie, unsigned char byte) {
+    if (trie->count == trie->cap) {
+        trie->cap = trie->cap ? trie->cap * 2 : 64;
+        trie->nodes = xrealloc(trie->nodes, trie->cap * sizeof(TrieNode));
+    }
+    TrieNode* node = &trie->nodes[trie->count];
+    node->byte = byte;
+    node->child = -1;
+    node->sibling = -1;
+    node->spec = -1;
+    return trie->count++;
+}
+
+// Returns the child of node for byte, or -1.
+static int trieChild(const KeywordTrie* trie, int node, unsigned char byte) {
+    int child = trie->nodes[node].child;
+    while (child != -1 && trie->nodes[child].byte != byte)
+        child = trie->nodes[child].sibling;
+    return child;
+}
+
+static void trieInsert(KeywordTrie* trie, const char* keyword, int spec) {
+    if (trie->count == 0)
+        trieNode(trie, 0); // Root
+    int node = 0;
+    for (; *keyword; keyword++) {
+        unsigned char byte = trieByte(trie, *keyword);
+        int child = trieChild(trie, node, byte);
+        if (child == -1) {
+            child = trieNode(trie, byte);
+            trie->nodes[child].sibling = trie->nodes[node].child;
+            trie->nodes[node].child = child;
+        }
+        node = child;
+    }
+    trie->nodes[node].spec = spec;
+}
+
+// Walks the text through the trie once and returns the longest registered keyword it starts with.
+static const CommandSpec* matchKeyword(const KeywordTrie* trie, Slice text) {
+    const CommandSpec* match = NULL;
+    if (trie->count == 0)
+        return NULL;
+    int node = 0;
+    for (int i = 0; i < text.len; i++) {
+        node = trieChild(trie, node, trieByte(trie, text.text[i]));
+        if (node == -1)
+            break;
+        if (trie->nodes[node].spec != -1)
+            match = tableAt(&commandSpecs, trie->nodes[node].spec);
+    }
+    return match;
+}
+
+// Registers a command for every state: lines starting with keyword (queries: trimmed lines ending
+// with '?' starting with keyword in any case) are lexed by lex and run by handle. A longer keyword
+// wins over a shorter one it extends. A query whose reads names every DataSet its answer depends on
+// has its answers cached.
+static void registerCommand(const char* keyword, int isQuery, unsigned int reads,
+                            void (*lex)(Slice, EntryBuffer*, Command*),
+                            int (*handle)(WitcherState*, const Command*, WitcherOutput*)) {
+    int index = tableAppend(&commandSpecs);
+    CommandSpec* spec = tableAt(&commandSpecs, index);
+    spec->keyword = keyword;
+    spec->isQuery = isQuery;
+    spec->reads = reads;
+    spec->lex = lex;
+    spec->handle = handle;
+    trieInsert(isQuery ? &queryKeywords : &actionKeywords, keyword, index);
+}
+
+static void registerBuiltinCommands(void) {
+    registerCommand("Geralt loots", 0, 0, lexLoot, processLoot);
+    registerCommand("Geralt trades", 0, 0, lexTrade, processTrade);
+    registerCommand("Geralt brews", 0, 0, lexBrew, processBrew);
+    registerCommand("Geralt learns", 0, 0, lexLearn, processLearn);
+    registerCommand("Geralt encounters a", 0, 0, lexEncounter, processEncounter);
+    registerCommand("Save", 0, 0, lexSave, processSave);
+    registerCommand("What is effective against", 1, 1u << DATA_BESTIARY, lexEffectiveQuery, processEffectiveQuery);
+    registerCommand("Total ingredient", 1, 1u << DATA_INVENTORY, lexIngredientQuery, processIngredientQuery);
+    registerCommand("Total potion", 1, 1u << DATA_INVENTORY, lexPotionQuery, processPotionQuery);
+    registerCommand("Total trophy", 1, 1u << DATA_TROPHIES, lexTrophyQuery, processTrophyQuery);
+    registerCommand("What is in", 1, 1u << DATA_FORMULAS, lexFormulaQuery, processFormulaQuery);
+    registerCommand("How many", 1, 1u << DATA_INVENTORY | 1u << DATA_FORMULAS, lexHowManyQuery, processHowManyQuery);
+    registerCommand("Which monsters is", 1, 1u << DATA_BESTIARY, lexCounteredQuery, processCounteredQuery);
+    registerCommand("Which formulas use", 1, 1u << DATA_FORMULAS, lexUsesQuery, processUsesQuery);
+    registerCommand("Which monsters can Geralt defeat", 1, 1u << DATA_INVENTORY | 1u << DATA_BESTIARY,
+                    lexDefeatableQuery, processDefeatableQuery);
+    registerCommand("What can Geralt brew", 1, 1u << DATA_INVENTORY | 1u << DATA_FORMULAS, lexBrewableQuery,
+                    processBrewableQuery);
+    registerCommand("Stats", 1, 0, lexStatsQuery, processStatsQuery);
+}
+
+// Registers the built-in actions and queries exactly once, whichever thread creates the first state.
+static void initCommands(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, registerBuiltinCommands);
+}
+
+// Lexes one input line (without its newline) into cmd, appending its list entries to buffer. The
+// leading keyword picks the command in one walk of a trie, then that command's lexer reads the rest of
+// the line in a single pass. Anything that does not match the grammar comes back as
+// WITCHER_CMD_INVALID. Lexing reads nothing but the registry, so any thread can lex.
+static void lexCommand(const char* line, int len, EntryBuffer* buffer, Command* cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->list = buffer;
+
+    Slice whole = {line, len};
+    Slice trimmed = trimSlice(line, line + len);
+    int isQuery = endsWithQuestionMark(trimmed); // If the input ends with '?', treat it as a query command.
+    Slice text = isQuery ? trimmed : whole;
+    cmd->spec = matchKeyword(isQuery ? &queryKeywords : &actionKeywords, text);
+    if (cmd->spec)
+        cmd->spec->lex(text, buffer, cmd);
+    else if (!isQuery && len == 4 && foldEqualScalar(line, "Exit", 4))
+        cmd->kind = WITCHER_CMD_EXIT;
+}
+
+// Runs a lexed command; returns 0 if it should be answered with INVALID.
+static int executeCommand(WitcherState* w, const Command* cmd, WitcherOutput* out) {
+    if (cmd->kind == WITCHER_CMD_INVALID || !cmd->spec)
+        return 0;
+    if (cmd->spec->reads)
+        return runCachedQuery(w, cmd, out);
+    return cmd->spec->handle(w, cmd, out);
+}
+
+// Runs a lexed line, answering INVALID where the grammar or the handler rejects it, and counts it in
+// the statistics. start is when the line's timing began, 0 unless timing is on.
+static CommandKind runCommand(WitcherState* w, const Command* cmd, long long start, WitcherOutput* out) {
+    w->stats.commands++;
+    w->stats.byKind[cmd->kind]++;
+    if (cmd->kind == WITCHER_CMD_EXIT)
+        return WITCHER_CMD_EXIT;
+    if (!executeCommand(w, cmd, out)) {
+        outPrintf(out, "INVALID\n");
+        w->stats.invalid++;
+    }
+    finishCommand(w, cmd->kind, start);
+    return cmd->kind;
+}
+
+// Lexes and runs one input line.
+WitcherCommandKind witcherExecute(WitcherState* w, const char* line, int len, WitcherOutput* out) {
+    long long start = w->stats.timing ? monotonicNs() : 0;
+    Command cmd;
+    w->entries.count = 0;
+    lexCommand(line, len, &w->entries, &cmd);
+    return runCommand(w, &cmd, start, out);
+}
+
+void witcherFormatStats(WitcherState* w, WitcherOutput* out) {
+    formatStats(w, out);
+}
+
+const char* witcherCommandName(WitcherCommandKind kind) {
+    return kind >= 0 && kind < WITCHER_COMMAND_KINDS ? commandKindNames[kind] : "unknown";
+}
+
+//Parallel Replay//
+
+// Lexes the lines of [start, end) into the batch. A line ends at its newline or the end of the file
+// and, as after fgets and strcspn, is cut at its first NUL.
+static void lexBatch(ReplayBatch* batch, const char* start, const char* end) {
+    batch->count = 0;
+    batch->entries.count = 0;
+    while (start < end) {
+        const char* newline = memchr(start, '\n', end - start);
+        const char* lineEnd = newline ? newline : end;
+        const char* nul = memchr(start, '\0', lineEnd - start);
+        if (batch->count == batch->cap) {
+            batch->cap = batch->cap ? batch->cap * 2 : 1024;
+            batch->commands = xrealloc(batch->commands, batch->cap * sizeof(Command));
+        }
+        const char* textEnd = nul ? nul : lineEnd;
+        if (textEnd - start > INT_MAX)
+            textEnd = start + INT_MAX;
+        lexCommand(start, (int)(textEnd - start), &batch->entries, &batch->commands[batch->count++]);
+        start = lineEnd + 1;
+    }
+}
+
+// Worker: claims the next chunk, extends it to the end of its last line and lexes it, while the
+// executor has room for another batch.
+static void* replayWorker(void* arg) {
+    Replay* replay = arg;
+    pthread_mutex_lock(&replay->lock);
+    for (;;) {
+        while (!replay->stop && replay->next < replay->len &&
+               replay->claimed - replay->done >= replay->batchCount)
+            pthread_cond_wait(&replay->freed, &replay->lock);
+        if (replay->stop || replay->next >= replay->len)
+            break;
+        const char* start = replay->text + replay->next;
+        size_t size = replay->len - replay->next;
+        if (size > REPLAY_CHUNK) {
+            const char* newline = memchr(start + REPLAY_CHUNK, '\n', size - REPLAY_CHUNK);
+            size = newline ? (size_t)(newline + 1 - start) : size;
+        }
+        replay->next += size;
+        ReplayBatch* batch = &replay->batches[replay->claimed++ % replay->batchCount];
+        pthread_mutex_unlock(&replay->lock);
+
+        lexBatch(batch, start, start + size);
+
+        pthread_mutex_lock(&replay->lock);
+        batch->ready = 1;
+        pthread_cond_broadcast(&replay->lexed);
+    }
+    pthread_mutex_unlock(&replay->lock);
+    return NULL;
+}
+
+// Executor: runs the batches in file order on the calling thread until the log or an Exit ends it.
+static void runReplay(WitcherState* w, Replay* replay, FILE* out) {
+    WitcherOutput response = {0};
+    int exited = 0;
+    for (long long seq = 0; !exited; seq++) {
+        ReplayBatch* batch = &replay->batches[seq % replay->batchCount];
+        pthread_mutex_lock(&replay->lock);
+        if (!batch->ready) {
+            pthread_mutex_unlock(&replay->lock);
+            journalCommit(&w->journal); // Sync while the lexers catch up rather than after
+            pthread_mutex_lock(&replay->lock);
+        }
+        while (!batch->ready && (seq < replay->claimed || replay->next < replay->len))
+            pthread_cond_wait(&replay->lexed, &replay->lock);
+        pthread_mutex_unlock(&replay->lock);
+        if (!batch->ready)
+            break; // Every chunk has been run
+        for (int i = 0; i < batch->count && !exited; i++) {
+            long long start = w->stats.timing ? monotonicNs() : 0;
+            exited = runCommand(w, &batch->commands[i], start, &response) == WITCHER_CMD_EXIT;
+            if (response.len >= REPLAY_OUTPUT_FLUSH) {
+                fwrite(response.text, 1, response.len, out);
+                response.len = 0;
+            }
+        }
+        pthread_mutex_lock(&replay->lock);
+        batch->ready = 0;
+        replay->done++;
+        replay->stop = exited;
+        pthread_cond_broadcast(&replay->freed);
+        pthread_mutex_unlock(&replay->lock);
+    }
+    if (response.len > 0)
+        fwrite(response.text, 1, response.len, out);
+    free(response.text);
+}
+
+// Worker threads lex the log ahead in parallel; the calling thread runs it in order.
+const char* witcherReplay(WitcherState* w, const char* path, int workers, FILE* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return strerror(errno);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return strerror(errno);
+    }
+    Replay replay = {0};
+    replay.len = st.st_size;
+    if (replay.len > 0) {
+        void* text = mmap(NULL, replay.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            close(fd);
+            return strerror(errno);
+        }
+        madvise(text, replay.len, MADV_SEQUENTIAL);
+        replay.text = text;
+    }
+    close(fd);
+
+    if (workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+    replay.batchCount = workers * REPLAY_AHEAD;
+    replay.batches = xrealloc(NULL, replay.batchCount * sizeof(ReplayBatch));
+    memset(replay.batches, 0, replay.batchCount * sizeof(ReplayBatch));
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.lexed, NULL);
+    pthread_cond_init(&replay.freed, NULL);
+    pthread_t* threads = xrealloc(NULL, workers * sizeof(pthread_t));
+    const char* error = NULL;
+    int started = 0;
+    while (started < workers && pthread_create(&threads[started], NULL, replayWorker, &replay) == 0)
+        started++;
+    if (started > 0)
+        runReplay(w, &replay, out);
+    else
+        error = "cannot start lexing threads";
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int b = 0; b < replay.batchCount; b++) {
+        free(replay.batches[b].commands);
+        free(replay.batches[b].entries.entries);
+    }
+    free(replay.batches);
+    free(threads);
+    pthread_cond_destroy(&replay.freed);
+    pthread_cond_destroy(&replay.lexed);
+    pthread_mutex_destroy(&replay.lock);
+    if (replay.text)
+        munmap((void*)replay.text, replay.len);
+    return error;
+}
+
+//Pipelined Streams//
+
+static void futexWait(_Atomic uint32_t* word, uint32_t seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Polls a ring counter until it moves off seen, spinning and then yielding to the other stages.
+// Returns 0 if it has not moved, when the caller would go to sleep.
+static int ringSpin(_Atomic uint32_t* word, uint32_t seen) {
+    for (int spin = 0; spin < RING_SPINS; spin++) {
+        if (atomic_load_explicit(word, memory_order_acquire) != seen)
+            return 1;
+        if (spin >= RING_SPINS - RING_YIELDS)
+            sched_yield();
+    }
+    return 0;
+}
+
+// Producer: waits for a free slot and returns its index.
+static int ringClaim(SpscRing* ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - tail < ring->size)
+            return (int)(head & (ring->size - 1));
+        if (!ringSpin(&ring->tail, tail)) {
+            atomic_store(&ring->producerSleeping, 1);
+            if (atomic_load(&ring->tail) == tail)
+                futexWait(&ring->tail, tail);
+            atomic_store(&ring->producerSleeping, 0);
+        }
+    }
+}
+
+// Producer: hands the claimed slot to the consumer.
+static void ringPublish(SpscRing* ring) {
+    atomic_fetch_add(&ring->head, 1);
+    if (atomic_load(&ring->consumerSleeping))
+        futexWake(&ring->head);
+}
+
+// Consumer: returns whether a published slot is waiting or arrives before the consumer would sleep.
+static int ringAwait(SpscRing* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return atomic_load_explicit(&ring->head, memory_order_acquire) != tail || ringSpin(&ring->head, tail);
+}
+
+// Consumer: waits for the next published slot and returns its index.
+static int ringNext(SpscRing* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head != tail)
+            return (int)(tail & (ring->size - 1));
+        if (!ringSpin(&ring->head, head)) {
+            atomic_store(&ring->consumerSleeping, 1);
+            if (atomic_load(&ring->head) == head)
+                futexWait(&ring->head, head);
+            atomic_store(&ring->consumerSleeping, 0);
+        }
+    }
+}
+
+// Consumer: gives the slot it was working on back to the producer.
+static void ringRelease(SpscRing* ring) {
+    atomic_fetch_add(&ring->tail, 1);
+    if (atomic_load(&ring->producerSleeping))
+        futexWake(&ring->tail);
+}
+
+// Reader stage: reads lines the way the interactive loop does and lexes them. It stops by itself after
+// the end of the input or an Exit line, the two lines that end the executor, so it never reads input
+// that would not be run and is never left blocked in a read once the executor is done.
+static void* pipelineReader(void* arg) {
+    Pipeline* pipeline = arg;
+    for (;;) {
+        PipelineLine* line = &pipeline->lines[ringClaim(&pipeline->lineRing)];
+        line->end = !fgets(line->line, MAX_INPUT_LEN, pipeline->in);
+        if (!line->end) {
+            line->entries.count = 0;
+            lexCommand(line->line, strcspn(line->line, "\n"), &line->entries, &line->cmd);
+        }
+        int last = line->end || line->cmd.kind == WITCHER_CMD_EXIT;
+        ringPublish(&pipeline->lineRing);
+        if (last)
+            return NULL;
+    }
+}
+
+// Writer stage: writes blocks out in order, flushing whenever it catches up with the executor and
+// would go to sleep.
+static void* pipelineWriter(void* arg) {
+    Pipeline* pipeline = arg;
+    for (;;) {
+        PipelineBlock* block = &pipeline->blocks[ringNext(&pipeline->blockRing)];
+        int end = block->end;
+        if (block->out.len > 0)
+            fwrite(block->out.text, 1, block->out.len, pipeline->out);
+        block->out.len = 0;
+        ringRelease(&pipeline->blockRing);
+        if (end || !ringAwait(&pipeline->blockRing))
+            fflush(pipeline->out);
+        if (end)
+            return NULL;
+    }
+}
+
+// Executor stage, on the calling thread: runs the lexed lines in order. A block of responses goes to
+// the writer once it is large, or when the executor runs out of lexed lines and would go to sleep,
+// so responses to a slow stream are not held back. Running out of lines also commits the journal, so
+// the changes of a burst are synced before the executor waits for more.
+static void runPipeline(WitcherState* w, Pipeline* pipeline) {
+    PipelineBlock* block = &pipeline->blocks[ringClaim(&pipeline->blockRing)];
+    for (int end = 0; !end;) {
+        PipelineLine* line = &pipeline->lines[ringNext(&pipeline->lineRing)];
+        end = line->end;
+        if (!end) {
+            long long start = w->stats.timing ? monotonicNs() : 0;
+            end = runCommand(w, &line->cmd, start, &block->out) == WITCHER_CMD_EXIT;
+        }
+        ringRelease(&pipeline->lineRing);
+        int idle = !end && !ringAwait(&pipeline->lineRing);
+        if (idle)
+            journalCommit(&w->journal);
+        if (end || block->out.len >= PIPELINE_BLOCK_FLUSH || (block->out.len > 0 && idle)) {
+            block->end = end;
+            ringPublish(&pipeline->blockRing);
+            if (!end)
+                block = &pipeline->blocks[ringClaim(&pipeline->blockRing)];
+        }
+    }
+}
+
+void witcherPipeline(WitcherState* w, FILE* in, FILE* out) {
+    Pipeline* pipeline = xrealloc(NULL, sizeof(Pipeline));
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->in = in;
+    pipeline->out = out;
+    pipeline->lineRing.size = PIPELINE_LINES;
+    pipeline->blockRing.size = PIPELINE_BLOCKS;
+    pipeline->lines = xrealloc(NULL, PIPELINE_LINES * sizeof(PipelineLine));
+    memset(pipeline->lines, 0, PIPELINE_LINES * sizeof(PipelineLine));
+
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, pipelineReader, pipeline) != 0 ||
+        pthread_create(&writer, NULL, pipelineWriter, pipeline) != 0) {
+        fprintf(stderr, "Cannot start pipeline threads\n");
+        exit(1);
+    }
+    runPipeline(w, pipeline);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    for (int i = 0; i < PIPELINE_LINES; i++)
+        free(pipeline->lines[i].entries.entries);
+    for (int b = 0; b < PIPELINE_BLOCKS; b++)
+        free(pipeline->blocks[b].out.text);
+    free(pipeline->lines);
+    free(pipeline);
+}
+
+//Library API//
+
+WitcherState* witcherCreate(void) {
+    initNameKernels();
+    initCommands();
+    WitcherState* w = xrealloc(NULL, sizeof(WitcherState));
+    memset(w, 0, sizeof(*w));
+    initTable(&w->symbols, &w->arena, sizeof(Symbol));
+    initTable(&w->itemNames, &w->arena, sizeof(Sym));
+    initTable(&w->itemQuantities, &w->arena, sizeof(int));
+    initTable(&w->itemCategories, &w->arena, sizeof(unsigned char));
+    initTable(&w->itemSortKeys, &w->arena, sizeof(SortKey));
+    initTable(&w->freeItems, &w->arena, sizeof(int));
+    initTable(&w->trophyMonsters, &w->arena, sizeof(Sym));
+    initTable(&w->trophyQuantities, &w->arena, sizeof(int));
+    initTable(&w->trophySortKeys, &w->arena, sizeof(SortKey));
+    initTable(&w->freeTrophies, &w->arena, sizeof(int));
+    initTable(&w->formulaBook, &w->arena, sizeof(Formula));
+    initTable(&w->bestiary, &w->arena, sizeof(BestiaryEntry));
+    initTable(&w->readyWords, &w->arena, sizeof(uint64_t));
+    initView(&w->itemViews[ITEM_INGREDIENT], w, itemOrder);
+    initView(&w->itemViews[ITEM_POTION], w, itemOrder);
+    initView(&w->trophyView, w, trophyOrder);
+    initView(&w->brewableView, w, formulaOrder);
+    w->viewLevelState = 2463534242u;
+    w->journal.fd = -1;
+    return w;
+}
+
+void witcherDestroy(WitcherState* w) {
+    if (!w)
+        return;
+    journalCommit(&w->journal);
+    if (w->journal.fd >= 0)
+        close(w->journal.fd);
+    free(w->journal.frame);
+    for (int t = 0; t < SNAPSHOT_TABLE_COUNT; t++)
+        free(snapshotTable(w, t)->chunks);
+    free(w->symbolIndex);
+    free(w->entries.entries);
+    free(w->plan.nodes);
+    for (int i = 0; w->queryCache && i < QUERY_CACHE_SLOTS; i++)
+        free(w->queryCache[i].text);
+    free(w->queryCache);
+    arenaFree(&w->arena);
+    if (w->snapshot)
+        munmap(w->snapshot, w->snapshotSize);
+    free(w);
+}
+
+void witcherSetTiming(WitcherState* w, int on) {
+    w->stats.timing = on;
+}
+
+void witcherSetFileCommands(WitcherState* w, int allowed) {
+    w->noFileCommands = !allowed;
+}
+
+const char* witcherLoad(WitcherState* w, const char* path) {
+    if (w->symbols.count > 0 || w->journal.seq > 0 || w->journal.fd >= 0)
+        return "state is not empty";
+    return loadSnapshot(w, path);
+}
+
+int witcherSave(WitcherState* w, const char* path) {
+    journalCommit(&w->journal); // The journal never lags a snapshot
+    return saveSnapshot(w, path);
+}
+
+const char* witcherOpenJournal(WitcherState* w, const char* path) {
+    if (w->journal.fd >= 0)
+        return "a journal is already open";
+    return openJournal(w, path);
+}
+
+void witcherCommit(WitcherState* w) {
+    journalCommit(&w->journal);
+}
+
+// Typed arguments must look like lexed ones: names are never empty.
+static int validName(WitcherSlice name) {
+    return name.len > 0 && name.text;
+}
+
+// Typed lists too: named entries with a quantity of at least one.
+static int validEntries(const WitcherEntry* entries, int count) {
+    if (count < 0 || (count > 0 && !entries))
+        return 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].quantity < 1 || !validName(entries[i].name))
+            return 0;
+    }
+    return 1;
+}
+
+WitcherResult witcherLoot(WitcherState* w, const WitcherEntry* ingredients, int count) {
+    if (!validEntries(ingredients, count))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_LOOT);
+    lootEntries(w, ingredients, count);
+    finishCommand(w, WITCHER_CMD_LOOT, start);
+    return WITCHER_OK;
+}
+
+WitcherResult witcherTrade(WitcherState* w, const WitcherEntry* trophyList, int trophyCount,
+                           const WitcherEntry* ingredients, int ingredientCount) {
+    if (!validEntries(trophyList, trophyCount) || !validEntries(ingredients, ingredientCount))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_TRADE);
+    WitcherResult result = WITCHER_NOT_ENOUGH_TROPHIES;
+    if (haveTrophies(w, trophyList, trophyCount)) {
+        lootEntries(w, ingredients, ingredientCount);
+        giveTrophies(w, trophyList, trophyCount);
+        result = WITCHER_OK;
+    }
+    finishCommand(w, WITCHER_CMD_TRADE, start);
+    return result;
+}
+
+WitcherResult witcherBrew(WitcherState* w, WitcherSlice potion) {
+    if (!validName(potion))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_BREW);
+    WitcherResult result = brewPotion(w, potion);
+    finishCommand(w, WITCHER_CMD_BREW, start);
+    return result;
+}
+
+WitcherResult witcherLearnEffective(WitcherState* w, WitcherSlice counter, int isSign, WitcherSlice monster) {
+    if (!validName(counter) || !validName(monster))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_LEARN_EFFECTIVE);
+    WitcherResult result = learnCounter(w, counter, isSign != 0, monster);
+    finishCommand(w, WITCHER_CMD_LEARN_EFFECTIVE, start);
+    return result;
+}
+
+WitcherResult witcherLearnFormula(WitcherState* w, WitcherSlice potion, const WitcherEntry* components, int count) {
+    if (!validName(potion) || count < 1 || count > MAX_COMPONENTS || !validEntries(components, count))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_LEARN_FORMULA);
+    WitcherResult result = learnPotionFormula(w, potion, components, count);
+    finishCommand(w, WITCHER_CMD_LEARN_FORMULA, start);
+    return result;
+}
+
+WitcherResult witcherEncounter(WitcherState* w, WitcherSlice monster) {
+    if (!validName(monster))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_ENCOUNTER);
+    WitcherResult result = encounterMonster(w, monster);
+    finishCommand(w, WITCHER_CMD_ENCOUNTER, start);
+    return result;
+}
+
+int witcherEffectiveAgainst(WitcherState* w, WitcherSlice monster, WitcherSlice counters[2]) {
+    long long start = startCommand(w, WITCHER_QUERY_EFFECTIVE);
+    int count = effectiveCounters(w, monster, counters);
+    finishCommand(w, WITCHER_QUERY_EFFECTIVE, start);
+    return count;
+}
+
+int witcherIngredientQuantity(WitcherState* w, WitcherSlice name) {
+    long long start = startCommand(w, WITCHER_QUERY_INGREDIENT);
+    int quantity = itemQuantity(w, findSym(w, name));
+    finishCommand(w, WITCHER_QUERY_INGREDIENT, start);
+    return quantity;
+}
+
+int witcherPotionQuantity(WitcherState* w, WitcherSlice name) {
+    long long start = startCommand(w, WITCHER_QUERY_POTION);
+    int quantity = itemQuantity(w, findSym(w, name));
+    finishCommand(w, WITCHER_QUERY_POTION, start);
+    return quantity;
+}
+
+int witcherTrophyQuantity(WitcherState* w, WitcherSlice monster) {
+    long long start = startCommand(w, WITCHER_QUERY_TROPHY);
+    int quantity = trophyQuantity(w, findSym(w, monster));
+    finishCommand(w, WITCHER_QUERY_TROPHY, start);
+    return quantity;
+}
+
+// Copies up to cap items of a view into out in listing order.
+static void listItemView(WitcherState* w, SortedView* view, WitcherEntry* out, int cap) {
+    int i = 0;
+    for (ViewNode* node = viewFirst(view); node && i < cap; node = node->next[0], i++)
+        out[i] = (WitcherEntry){*itemQuantityAt(w, node->item), symSlice(w, *itemNameAt(w, node->item))};
+}
+
+int witcherListIngredients(WitcherState* w, WitcherEntry* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_INGREDIENT);
+    listItemView(w, &w->itemViews[ITEM_INGREDIENT], out, cap);
+    finishCommand(w, WITCHER_QUERY_INGREDIENT, start);
+    return w->itemViews[ITEM_INGREDIENT].count;
+}
+
+int witcherListPotions(WitcherState* w, WitcherEntry* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_POTION);
+    listItemView(w, &w->itemViews[ITEM_POTION], out, cap);
+    finishCommand(w, WITCHER_QUERY_POTION, start);
+    return w->itemViews[ITEM_POTION].count;
+}
+
+int witcherListTrophies(WitcherState* w, WitcherEntry* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_TROPHY);
+    int i = 0;
+    for (ViewNode* node = viewFirst(&w->trophyView); node && i < cap; node = node->next[0], i++)
+        out[i] = (WitcherEntry){*trophyQuantityAt(w, node->item), symSlice(w, *trophyMonsterAt(w, node->item))};
+    finishCommand(w, WITCHER_QUERY_TROPHY, start);
+    return w->trophyView.count;
+}
+
+int witcherFormula(WitcherState* w, WitcherSlice potion, WitcherEntry components[MAX_COMPONENTS]) {
+    long long start = startCommand(w, WITCHER_QUERY_FORMULA);
+    Component sorted[MAX_COMPONENTS];
+    int count = sortedComponents(w, potion, sorted);
+    for (int i = 0; i < count; i++)
+        components[i] = (WitcherEntry){sorted[i].quantity, symSlice(w, sorted[i].name)};
+    finishCommand(w, WITCHER_QUERY_FORMULA, start);
+    return count;
+}
+
+int witcherListBrewable(WitcherState* w, WitcherEntry* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_BREWABLE);
+    int i = 0;
+    for (ViewNode* node = viewFirst(&w->brewableView); node && i < cap; node = node->next[0], i++) {
+        Formula* f = formulaAt(w, node->item);
+        out[i] = (WitcherEntry){f->brewable, symSlice(w, f->potionName)};
+    }
+    finishCommand(w, WITCHER_QUERY_BREWABLE, start);
+    return w->brewableView.count;
+}
+
+WitcherResult witcherBrewMany(WitcherState* w, WitcherSlice potion, int count) {
+    if (count < 1 || !validName(potion))
+        return WITCHER_BAD_ARGUMENT;
+    long long start = startCommand(w, WITCHER_CMD_BULK_BREW);
+    Sym cycle;
+    WitcherResult result = brewMany(w, potion, count, &cycle);
+    finishCommand(w, WITCHER_CMD_BULK_BREW, start);
+    return result;
+}
+
+int witcherHowManyCanBrew(WitcherState* w, WitcherSlice potion) {
+    long long start = startCommand(w, WITCHER_QUERY_HOW_MANY);
+    int count = howManyCanBrew(w, potion);
+    finishCommand(w, WITCHER_QUERY_HOW_MANY, start);
+    return count;
+}
+
+int witcherCounteredBy(WitcherState* w, WitcherSlice counter, WitcherSlice* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_COUNTERED);
+    int count = 0;
+    for (CounterLink link = firstCountered(w, counter); link != -1; link = nextCountered(w, link), count++) {
+        if (count < cap)
+            out[count] = symSlice(w, bestiaryAt(w, link / 2)->monsterName);
+    }
+    finishCommand(w, WITCHER_QUERY_COUNTERED, start);
+    return count;
+}
+
+int witcherFormulasUsing(WitcherState* w, WitcherSlice ingredient, WitcherSlice* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_USES);
+    int count = 0;
+    for (UseLink link = firstUseOf(w, ingredient); link != -1; link = nextUseOf(w, link), count++) {
+        if (count < cap)
+            out[count] = symSlice(w, formulaAt(w, link / MAX_COMPONENTS)->potionName);
+    }
+    finishCommand(w, WITCHER_QUERY_USES, start);
+    return count;
+}
+
+int witcherListDefeatable(WitcherState* w, WitcherSlice* out, int cap) {
+    long long start = startCommand(w, WITCHER_QUERY_DEFEATABLE);
+    int count;
+    int* entries = readyMonsters(w, &count);
+    for (int i = 0; i < count && i < cap; i++)
+        out[i] = symSlice(w, bestiaryAt(w, entries[i])->monsterName);
+    free(entries);
+    finishCommand(w, WITCHER_QUERY_DEFEATABLE, start);
+    return count;
+}
+
+void witcherGetStats(WitcherState* w, WitcherStats* out) {
+    *out = w->stats;
+    out->formulas = w->formulaBook.count;
+    out->bestiaryEntries = w->bestiary.count;
+}
@@ -0,0 +1,186 @@
+#ifndef WITCHER_H
+#define WITCHER_H
+
+// Witcher Tracker library: inventory, trophies, formula book and bestiary of one campaign behind a
+// WitcherState handle. Every call works on the state it is given, so a process can hold any number
+// of independent campaigns, and different threads can create and use different states at the same
+// time; a single state must not be used from two threads at once.
+//
+// The typed calls take names as slices and write their results into buffers the caller provides.
+// witcherExecute runs one line of the text command language and appends its response to a
+// WitcherOutput, which is all the interactive interpreter does.
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define MAX_NAME_LEN 64     // For names of items, monsters, etc.
+#define MAX_INPUT_LEN 1024  // Maximum length for user input lines
+#define MAX_COMPONENTS 10   // Maximum number of components in a potion formula
+#define LATENCY_BUCKETS 32  // Power-of-two latency buckets per command kind, up to 2^31 ns
+
+typedef struct WitcherState WitcherState;
+
+// A run of characters; not NUL-terminated. Names longer than MAX_NAME_LEN - 1 are clipped.
+typedef struct {
+    const char* text;
+    int len;
+} WitcherSlice;
+
+// One "<quantity> <name>" entry of a loot, trade or formula list, or of a listing.
+typedef struct {
+    int quantity;
+    WitcherSlice name;
+} WitcherEntry;
+
+typedef enum {
+    WITCHER_CMD_INVALID,
+    WITCHER_CMD_EXIT,
+    WITCHER_CMD_LOOT,
+    WITCHER_CMD_TRADE,
+    WITCHER_CMD_BREW,
+    WITCHER_CMD_LEARN_EFFECTIVE,
+    WITCHER_CMD_LEARN_FORMULA,
+    WITCHER_CMD_ENCOUNTER,
+    WITCHER_CMD_SAVE,
+    WITCHER_QUERY_EFFECTIVE,
+    WITCHER_QUERY_INGREDIENT,
+    WITCHER_QUERY_POTION,
+    WITCHER_QUERY_TROPHY,
+    WITCHER_QUERY_FORMULA,
+    WITCHER_QUERY_STATS,
+    WITCHER_QUERY_BREWABLE,
+    WITCHER_CMD_BULK_BREW,
+    WITCHER_QUERY_HOW_MANY,
+    WITCHER_QUERY_COUNTERED,
+    WITCHER_QUERY_USES,
+    WITCHER_QUERY_DEFEATABLE,
+    WITCHER_COMMAND_KINDS
+} WitcherCommandKind;
+
+// Outcome of a typed action.
+typedef enum {
+    WITCHER_OK,                     // Looted, traded, brewed, formula learned or monster defeated
+    WITCHER_NOT_ENOUGH_TROPHIES,
+    WITCHER_NO_FORMULA,
+    WITCHER_NOT_ENOUGH_INGREDIENTS,
+    WITCHER_NEW_ENTRY,              // First effectiveness learned for a monster
+    WITCHER_ENTRY_UPDATED,
+    WITCHER_ALREADY_KNOWN,          // Effectiveness or formula already known; nothing changed
+    WITCHER_UNPREPARED,             // Geralt barely escapes with his life
+    WITCHER_BAD_ARGUMENT,           // Empty name, quantity below 1 or too many components; nothing changed
+    WITCHER_CYCLIC_FORMULA          // A bulk brew would need a potion to brew itself; nothing changed
+} WitcherResult;
+
+// Counters behind the "Stats?" query. Latencies are only measured while timing is on.
+typedef struct {
+    long long commands;
+    long long invalid;
+    long long failedBrews;  // "Not enough ingredients"
+    long long failedTrades; // "Not enough trophies"
+    long long unprepared;   // Encounters Geralt barely escapes
+    long long cacheHits;    // Queries answered from the query cache
+    long long cacheMisses;  // Cacheable queries that had to be run
+    long long byKind[WITCHER_COMMAND_KINDS];
+    long long latency[WITCHER_COMMAND_KINDS][LATENCY_BUCKETS]; // Bucket b counts latencies below 2^b ns
+    int timing;
+    int peakItems;       // Most inventory slots in use at once
+    int peakTrophies;    // Most trophy slots in use at once
+    int formulas;        // Formulas and bestiary entries are never removed, so these are also their peaks
+    int bestiaryEntries;
+} WitcherStats;
+
+// Response text of witcherExecute. The caller owns the buffer; responses are appended at len and the
+// buffer grows as needed, so the caller resets len once it has consumed them.
+typedef struct {
+    char* text;
+    size_t len;
+    size_t cap;
+} WitcherOutput;
+
+//State//
+
+WitcherState* witcherCreate(void);
+// Commits pending journal records, closes the journal and releases everything the state holds.
+void witcherDestroy(WitcherState* w);
+void witcherSetTiming(WitcherState* w, int on);
+// With allowed 0, commands that write files ("Save <file>") are answered INVALID, for states run on
+// behalf of untrusted clients. Files are allowed by default.
+void witcherSetFileCommands(WitcherState* w, int allowed);
+// Replaces a fresh state with a snapshot written by witcherSave. Returns NULL on success, otherwise
+// what is wrong with the file.
+const char* witcherLoad(WitcherState* w, const char* path);
+// Writes a snapshot of the state to path. Returns 0 with errno set on failure.
+int witcherSave(WitcherState* w, const char* path);
+// Opens or creates a journal, replaying the records the state does not have yet. Returns NULL on
+// success, otherwise what is wrong. A journal write that fails later terminates the process.
+const char* witcherOpenJournal(WitcherState* w, const char* path);
+// Commits the journal records waiting for their group commit.
+void witcherCommit(WitcherState* w);
+
+//Actions//
+
+// Every action answers WITCHER_BAD_ARGUMENT for an empty name, as the command would be INVALID.
+WitcherResult witcherLoot(WitcherState* w, const WitcherEntry* ingredients, int count);
+// Trophies are named "<monster> trophy", as in a trade command.
+WitcherResult witcherTrade(WitcherState* w, const WitcherEntry* trophies, int trophyCount,
+                           const WitcherEntry* ingredients, int ingredientCount);
+WitcherResult witcherBrew(WitcherState* w, WitcherSlice potion);
+// Brews count of the potion in one step, first brewing any potion among the components that Geralt
+// holds too few of. Either the whole bulk brew happens or nothing changes.
+WitcherResult witcherBrewMany(WitcherState* w, WitcherSlice potion, int count);
+WitcherResult witcherLearnEffective(WitcherState* w, WitcherSlice counter, int isSign, WitcherSlice monster);
+// A formula needs at least one component; WITCHER_BAD_ARGUMENT otherwise.
+WitcherResult witcherLearnFormula(WitcherState* w, WitcherSlice potion, const WitcherEntry* components, int count);
+WitcherResult witcherEncounter(WitcherState* w, WitcherSlice monster);
+
+//Queries//
+// Names in results point into the state and stay valid until it is destroyed.
+
+// Fills counters with the known potion and sign against the monster, sorted by name; returns how many.
+int witcherEffectiveAgainst(WitcherState* w, WitcherSlice monster, WitcherSlice counters[2]);
+// Like the text queries, both look the name up in the whole inventory.
+int witcherIngredientQuantity(WitcherState* w, WitcherSlice name);
+int witcherPotionQuantity(WitcherState* w, WitcherSlice name);
+int witcherTrophyQuantity(WitcherState* w, WitcherSlice monster);
+// Listings fill at most cap entries in listing order and return how many there are in total.
+int witcherListIngredients(WitcherState* w, WitcherEntry* out, int cap);
+int witcherListPotions(WitcherState* w, WitcherEntry* out, int cap);
+int witcherListTrophies(WitcherState* w, WitcherEntry* out, int cap);
+// Fills components in "What is in" order; returns how many, 0 if the potion has no formula.
+int witcherFormula(WitcherState* w, WitcherSlice potion, WitcherEntry components[MAX_COMPONENTS]);
+// Lists the potions with a formula the inventory could brew now, with how many times each could be
+// brewed in a row, by potion name.
+int witcherListBrewable(WitcherState* w, WitcherEntry* out, int cap);
+// How many of the potion witcherBrewMany could make now; -1 if the potion has no formula.
+int witcherHowManyCanBrew(WitcherState* w, WitcherSlice potion);
+// Reverse lookups: fill at most cap names, sorted, and return how many there are in total. The monsters
+// a potion or sign is known to be effective against, and the potions whose formulas use an ingredient.
+int witcherCounteredBy(WitcherState* w, WitcherSlice counter, WitcherSlice* out, int cap);
+int witcherFormulasUsing(WitcherState* w, WitcherSlice ingredient, WitcherSlice* out, int cap);
+// Monsters Geralt could defeat now, with a known sign or an effective potion in stock, sorted; fills
+// at most cap and returns how many there are.
+int witcherListDefeatable(WitcherState* w, WitcherSlice* out, int cap);
+void witcherGetStats(WitcherState* w, WitcherStats* out);
+
+//Text Commands//
+
+// Runs one input line (without its newline) and appends its response. Returns the command's kind so
+// the caller can stop at WITCHER_CMD_EXIT.
+WitcherCommandKind witcherExecute(WitcherState* w, const char* line, int len, WitcherOutput* out);
+// Runs every line of a command log file through the same grammar and writes the responses to out,
+// stopping at the end of the file or at Exit. The file is memory-mapped and cut into line-aligned
+// chunks that workers threads (one per core if workers <= 0) lex ahead of the calling thread, which
+// runs the commands in file order, so the responses are those of witcherExecute line by line. Lines
+// are read whole at any length rather than split at MAX_INPUT_LEN. Returns NULL on success, otherwise
+// what is wrong with the file.
+const char* witcherReplay(WitcherState* w, const char* path, int workers, FILE* out);
+// Runs every line read from in and writes the responses to out, like a loop over witcherExecute, until
+// the end of the input or Exit. Reading and lexing, running, and writing are pipelined on three threads
+// connected by bounded lock-free rings, so a slow input or output stream does not stall the commands;
+// responses are formatted by the thread running them and flushed whenever the writer catches up.
+void witcherPipeline(WitcherState* w, FILE* in, FILE* out);
+// Appends the "Stats?" report.
+void witcherFormatStats(WitcherState* w, WitcherOutput* out);
+const char* witcherCommandName(WitcherCommandKind kind);
+
+#endif